@@ -0,0 +1,431 @@
+#include "analysis.hpp"
+#include "window.hpp"
+#include <cmath>
+#include <algorithm>
+
+using namespace wavalyzer;
+using namespace std;
+
+const double PI = 3.14159265358979323846;
+
+// Windows are transformed this many at a time by the FFT engine
+const size_t FFT_ENGINE_BATCH_SIZE = 8;
+
+// Windows between two full FFTs in the sliding DFT engine
+const size_t SLIDING_DFT_RESYNC_INTERVAL = 1024;
+
+analysis_engine::analysis_engine(const analysis_config_t& _config)
+    : config(_config),
+      bucket_count(wavalyzer::get_bucket_count(_config.step_hertz, _config.min_hertz, _config.max_hertz)),
+      gain_compensation(1.0f / get_window(_config.window, _config.window_size).coherent_gain)
+{
+}
+
+fft_engine::fft_engine(const analysis_config_t& _config)
+    : analysis_engine(_config),
+      buckets(_config.sample_rate, _config.window_size, _config.step_hertz,
+              _config.min_hertz, _config.max_hertz, static_cast<int>(_config.window_size / 2)),
+      plan(_config.window_size, FFT_ENGINE_BATCH_SIZE),
+      window(&get_window(_config.window, _config.window_size).coefficients[0]),
+      padded_frames(_config.window_size * FFT_ENGINE_BATCH_SIZE)
+{
+}
+
+void fft_engine::analyze(const vector<float>& samples,
+                         const size_t* starts,
+                         size_t count,
+                         float* destination)
+{
+    size_t window_size = config.window_size;
+    const float* frames[FFT_ENGINE_BATCH_SIZE];
+
+    for (size_t first = 0; first < count; first += FFT_ENGINE_BATCH_SIZE) {
+        size_t batched = min(FFT_ENGINE_BATCH_SIZE, count - first);
+
+        for (size_t f = 0; f < batched; f++) {
+            size_t start = starts[first + f];
+            if (start + window_size <= samples.size()) {
+                frames[f] = &samples[start];
+                continue;
+            }
+
+            float* padded = &padded_frames[f * window_size];
+            for (size_t i = 0; i < window_size; i++) {
+                padded[i] = start + i < samples.size() ? samples[start + i] : 0.0f;
+            }
+
+            frames[f] = padded;
+        }
+
+        fft_from_samples_batch(plan,
+                               buckets,
+                               frames,
+                               batched,
+                               window,
+                               gain_compensation,
+                               destination + first * bucket_count);
+    }
+}
+
+sliding_dft_engine::sliding_dft_engine(const analysis_config_t& _config)
+    : analysis_engine(_config),
+      buckets(_config.sample_rate, _config.window_size, _config.step_hertz,
+              _config.min_hertz, _config.max_hertz, static_cast<int>(_config.window_size / 2)),
+      resync_plan(_config.window_size),
+      resync_samples(_config.window_size),
+      position(0)
+{
+    window_terms = get_window_cosine_terms(config.window);
+    if (window_terms.empty()) {
+        throw analysis_exception("The sliding engine cannot apply a `" + get_window_name(config.window) +
+                                 "` window, only cosine sums");
+    }
+
+    size_t size = config.window_size;
+    first_bin = buckets.get_first_bin();
+    end_bin = buckets.get_end_bin();
+    if (buckets.get_bin_count() == 0) {
+        return;
+    }
+
+    int margin = static_cast<int>(window_terms.size()) - 1;
+    tracked_first_bin = first_bin - margin;
+    size_t tracked = end_bin - first_bin + 1 + 2 * margin;
+
+    roots.resize(size);
+    for (size_t m = 0; m < size; m++) {
+        roots[m] = polar(1.0, 2.0 * PI * m / size);
+    }
+
+    bins.resize(tracked);
+    goertzel_coefficients.resize(tracked);
+    goertzel_1.resize(tracked);
+    goertzel_2.resize(tracked);
+    for (size_t t = 0; t < tracked; t++) {
+        goertzel_coefficients[t] = 2.0 * root(tracked_first_bin + static_cast<int>(t)).real();
+    }
+
+    magnitudes.resize(end_bin - first_bin + 1);
+}
+
+float sliding_dft_engine::sample_at(const vector<float>& samples, size_t index) const
+{
+    return index < samples.size() ? samples[index] : 0.0f;
+}
+
+const complex<double>& sliding_dft_engine::root(long long exponent) const
+{
+    long long size = static_cast<long long>(config.window_size);
+    return roots[((exponent % size) + size) % size];
+}
+
+void sliding_dft_engine::resync(const vector<float>& samples, size_t start)
+{
+    size_t size = config.window_size;
+    for (size_t i = 0; i < size; i++) {
+        resync_samples[i] = sample_at(samples, start + i);
+    }
+
+    const complex<float>* spectrum = resync_plan.execute(&resync_samples[0]);
+
+    // Bins outside 0..N/2 mirror the ones inside, as the input is real
+    int half = static_cast<int>(size / 2);
+    for (size_t t = 0; t < bins.size(); t++) {
+        int k = tracked_first_bin + static_cast<int>(t);
+        if (k < 0) {
+            bins[t] = conj(complex<double>(spectrum[-k]));
+        } else if (k > half) {
+            bins[t] = conj(complex<double>(spectrum[static_cast<int>(size) - k]));
+        } else {
+            bins[t] = complex<double>(spectrum[k]);
+        }
+    }
+
+    position = start;
+}
+
+// Moving the window from s to s + h turns bin k into
+//   S'[k] = w^(kh) (S[k] + sum_j d[j] w^(-kj)),  w = exp(2 pi i / N),
+// with d[j] = x[s + N + j] - x[s + j]. The sum is a Goertzel filter over d,
+// which only takes one real multiplication per sample and bin.
+void sliding_dft_engine::slide(const vector<float>& samples, size_t start)
+{
+    size_t size = config.window_size,
+           tracked = bins.size();
+
+    fill(goertzel_1.begin(), goertzel_1.end(), 0.0);
+    fill(goertzel_2.begin(), goertzel_2.end(), 0.0);
+
+    for (size_t s = position; s < start; s++) {
+        double d = static_cast<double>(sample_at(samples, s + size)) - sample_at(samples, s);
+
+        for (size_t t = 0; t < tracked; t++) {
+            double next = d + goertzel_coefficients[t] * goertzel_1[t] - goertzel_2[t];
+            goertzel_2[t] = goertzel_1[t];
+            goertzel_1[t] = next;
+        }
+    }
+
+    // The filter leaves y = sum_j d[j] w^(k(h - 1 - j)), so the bracket
+    // above is w^(-k(h - 1)) y
+    long long hop = static_cast<long long>(start - position);
+    for (size_t t = 0; t < tracked; t++) {
+        long long k = tracked_first_bin + static_cast<long long>(t);
+        complex<double> y = goertzel_1[t] - root(-k) * goertzel_2[t];
+
+        bins[t] = root(k * hop) * bins[t] + root(k) * y;
+    }
+
+    position = start;
+}
+
+void sliding_dft_engine::analyze(const vector<float>& samples,
+                                 const size_t* starts,
+                                 size_t count,
+                                 float* destination)
+{
+    if (buckets.get_bin_count() == 0) {
+        // The whole range is above Nyquist
+        fill(destination, destination + count * bucket_count, 0.0f);
+        return;
+    }
+
+    size_t size = config.window_size;
+    double fft_cost = size * log2(static_cast<double>(size));
+    int margin = static_cast<int>(window_terms.size()) - 1;
+    float factor = gain_compensation / size;
+
+    for (size_t f = 0; f < count; f++) {
+        size_t start = starts[f];
+
+        // Every call starts from the samples themselves, and so does every
+        // SLIDING_DFT_RESYNC_INTERVAL-th window into it, going backwards, or
+        // a hop long enough that sliding would cost more than a new FFT.
+        // That makes the output depend on nothing but how the windows are
+        // split into calls.
+        bool slide_is_cheaper = f % SLIDING_DFT_RESYNC_INTERVAL != 0 && start >= position &&
+                                static_cast<double>(start - position) * bins.size() < fft_cost;
+
+        if (slide_is_cheaper) {
+            slide(samples, start);
+        } else {
+            resync(samples, start);
+        }
+
+        // Windowing by sum_m (-1)^m a_m cos(2 pi m n / N) mixes every bin
+        // with its neighbors m bins away, weighted by (-1)^m a_m / 2
+        for (int b = first_bin; b <= end_bin; b++) {
+            size_t t = b - tracked_first_bin;
+            complex<double> x = static_cast<double>(window_terms[0]) * bins[t];
+
+            for (int m = 1; m <= margin; m++) {
+                double weight = (m % 2 == 0 ? 0.5 : -0.5) * window_terms[m];
+                x += weight * (bins[t - m] + bins[t + m]);
+            }
+
+            magnitudes[b - first_bin] = static_cast<float>(abs(x));
+        }
+
+        buckets.reduce(&magnitudes[0], factor, destination + f * bucket_count);
+    }
+}
+
+// Enough points per bin, which is sample_rate / window_size wide, for one
+// every step_hertz
+size_t get_zoom_factor(const analysis_config_t& config)
+{
+    size_t bin_step = config.window_size * config.step_hertz;
+    return max<size_t>(1, (config.sample_rate + bin_step - 1) / bin_step);
+}
+
+zoom_engine::zoom_engine(const analysis_config_t& _config)
+    : analysis_engine(_config),
+      zoom(get_zoom_factor(_config)),
+      buckets(_config.sample_rate, _config.window_size * zoom, _config.step_hertz,
+              _config.min_hertz, _config.max_hertz, static_cast<int>(_config.window_size * zoom / 2)),
+      window(&get_window(_config.window, _config.window_size).coefficients[0]),
+      window_samples(_config.window_size)
+{
+    size_t size = config.window_size,
+           grid_size = size * zoom,
+           first_point = buckets.get_first_bin(),
+           point_count = buckets.get_bin_count();
+
+    if (point_count == 0) {
+        return;
+    }
+
+    magnitudes.resize(point_count);
+
+    // Rough operation counts: a Goertzel filter takes a multiplication and
+    // two additions per sample and point, and the chirp-z transform two
+    // complex FFTs of its convolution size
+    double goertzel_cost = 3.0 * size * point_count;
+
+    chirp_z = make_unique<chirp_z_plan>(size, grid_size, first_point, point_count);
+    double convolution_size = chirp_z->get_convolution_size(),
+           chirp_z_cost = 10.0 * convolution_size * log2(convolution_size) + 8.0 * convolution_size;
+
+    double fft_cost = zoom == 1 ? 2.5 * size * log2(static_cast<double>(size)) + 4.0 * size : INFINITY;
+
+    if (fft_cost <= goertzel_cost && fft_cost <= chirp_z_cost) {
+        method = METHOD_FFT;
+        fft = make_unique<real_fft_plan>(size);
+    } else if (goertzel_cost <= chirp_z_cost) {
+        method = METHOD_GOERTZEL;
+    } else {
+        method = METHOD_CHIRP_Z;
+    }
+
+    if (method != METHOD_CHIRP_Z) {
+        chirp_z.reset();
+    }
+
+    if (method == METHOD_GOERTZEL) {
+        goertzel_coefficients.resize(point_count);
+        goertzel_1.resize(point_count);
+        goertzel_2.resize(point_count);
+        for (size_t p = 0; p < point_count; p++) {
+            goertzel_coefficients[p] = 2.0 * cos(2.0 * PI * (first_point + p) / grid_size);
+        }
+    }
+}
+
+string zoom_engine::get_method_name() const
+{
+    if (buckets.get_bin_count() == 0) {
+        return "none";
+    }
+
+    switch (method) {
+    case METHOD_FFT: return "fft";
+    case METHOD_GOERTZEL: return "goertzel";
+    case METHOD_CHIRP_Z: return "chirp-z";
+    }
+
+    return "";
+}
+
+// Runs every point's filter over the window; only magnitudes are needed,
+// so the final phase rotation is left out
+void zoom_engine::goertzel()
+{
+    size_t point_count = magnitudes.size();
+
+    fill(goertzel_1.begin(), goertzel_1.end(), 0.0);
+    fill(goertzel_2.begin(), goertzel_2.end(), 0.0);
+
+    for (size_t n = 0; n < window_samples.size(); n++) {
+        double x = window_samples[n];
+
+        for (size_t p = 0; p < point_count; p++) {
+            double next = x + goertzel_coefficients[p] * goertzel_1[p] - goertzel_2[p];
+            goertzel_2[p] = goertzel_1[p];
+            goertzel_1[p] = next;
+        }
+    }
+
+    for (size_t p = 0; p < point_count; p++) {
+        double s1 = goertzel_1[p], s2 = goertzel_2[p],
+               power = s1 * s1 + s2 * s2 - goertzel_coefficients[p] * s1 * s2;
+
+        magnitudes[p] = static_cast<float>(sqrt(max(power, 0.0)));
+    }
+}
+
+void zoom_engine::analyze(const vector<float>& samples,
+                          const size_t* starts,
+                          size_t count,
+                          float* destination)
+{
+    if (buckets.get_bin_count() == 0) {
+        // The whole range is above Nyquist
+        fill(destination, destination + count * bucket_count, 0.0f);
+        return;
+    }
+
+    size_t size = config.window_size,
+           point_count = magnitudes.size();
+
+    // Each bin's worth of spectrum is spread over `zoom` points, so their
+    // sum is scaled back to what a bin would have
+    float factor = gain_compensation / size / zoom;
+
+    for (size_t f = 0; f < count; f++) {
+        size_t start = starts[f];
+        bool whole = start + size <= samples.size();
+
+        // The FFT windows the samples as it packs them; the others get them
+        // windowed in the same pass that copies them out
+        if (method != METHOD_FFT) {
+            for (size_t i = 0; i < size; i++) {
+                window_samples[i] = (start + i < samples.size() ? samples[start + i] : 0.0f) * window[i];
+            }
+        } else if (!whole) {
+            for (size_t i = 0; i < size; i++) {
+                window_samples[i] = start + i < samples.size() ? samples[start + i] : 0.0f;
+            }
+        }
+
+        const float* point_magnitudes = &magnitudes[0];
+        switch (method) {
+        case METHOD_FFT:
+            fft->execute(whole ? &samples[start] : &window_samples[0], window);
+            point_magnitudes = fft->get_magnitudes(buckets.get_first_bin(), point_count);
+            break;
+
+        case METHOD_GOERTZEL:
+            goertzel();
+            break;
+
+        case METHOD_CHIRP_Z:
+            chirp_z->execute(&window_samples[0]);
+            point_magnitudes = chirp_z->get_magnitudes();
+            break;
+        }
+
+        buckets.reduce(point_magnitudes, factor, destination + f * bucket_count);
+    }
+}
+
+window_layout_t wavalyzer::get_window_layout(size_t sample_rate,
+                                             size_t total_samples,
+                                             size_t window_size,
+                                             size_t step_ms)
+{
+    window_layout_t layout;
+    layout.ms_samples = sample_rate / 1000.0f;
+    layout.ms_per_window = window_size / layout.ms_samples;
+    layout.total_ms = total_samples / layout.ms_samples;
+    layout.first_ms = ceil(layout.ms_per_window / 2);
+    layout.step_ms = static_cast<int>(step_ms);
+
+    long long end_ms = floor(layout.total_ms - layout.ms_per_window / 2);
+    layout.window_count = end_ms > layout.first_ms ?
+                          (end_ms - layout.first_ms + layout.step_ms - 1) / layout.step_ms : 0;
+
+    return layout;
+}
+
+vector<string> wavalyzer::get_analysis_engine_names()
+{
+    return { "fft", "sliding", "zoom" };
+}
+
+unique_ptr<analysis_engine> wavalyzer::make_analysis_engine(const string& name,
+                                                            const analysis_config_t& config)
+{
+    if (name == "fft") {
+        return unique_ptr<analysis_engine>(new fft_engine(config));
+    }
+
+    if (name == "sliding") {
+        return unique_ptr<analysis_engine>(new sliding_dft_engine(config));
+    }
+
+    if (name == "zoom") {
+        return unique_ptr<analysis_engine>(new zoom_engine(config));
+    }
+
+    throw analysis_exception("Unknown analysis engine `" + name + "`");
+}
@@ -0,0 +1,191 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <complex>
+#include <memory>
+#include <exception>
+#include "fft.hpp"
+#include "window.hpp"
+
+namespace wavalyzer {
+    class analysis_exception : public std::exception {
+    private:
+        std::string message;
+
+    public:
+        analysis_exception(const std::string& _message)
+            : message(_message) {}
+
+        analysis_exception(const std::string&& _message)
+            : message(std::move(_message)) {}
+
+        virtual const char* what() const throw() {
+            return message.c_str();
+        }
+    };
+
+    struct analysis_config_t {
+        size_t sample_rate;
+        size_t window_size;
+        window_t window;
+        size_t min_hertz;
+        size_t max_hertz;
+        size_t step_hertz;
+    };
+
+    // Where the windows of a file go: one centered at every step_ms
+    // milliseconds, from the first to the last that fit whole
+    struct window_layout_t {
+        float ms_samples, ms_per_window;
+        int total_ms, first_ms, step_ms;
+        size_t window_count;
+
+        size_t get_window_start(size_t index) const {
+            int ms = first_ms + static_cast<int>(index) * step_ms;
+            return static_cast<size_t>((ms - ms_per_window / 2) * ms_samples);
+        }
+    };
+
+    window_layout_t get_window_layout(size_t sample_rate, size_t total_samples, size_t window_size, size_t step_ms);
+
+    // Turns windows of samples into histogram buckets, as fft_from_samples
+    // does for a single window
+    class analysis_engine {
+    protected:
+        analysis_config_t config;
+        size_t bucket_count;
+        float gain_compensation;
+
+    public:
+        analysis_engine(const analysis_config_t& _config);
+        virtual ~analysis_engine() {}
+
+        size_t get_bucket_count() const {
+            return bucket_count;
+        }
+
+        // Analyzes `count` windows, the f-th one starting at samples[starts[f]].
+        // Samples past the end read as silence. The buckets of all windows are
+        // written to `destination`, window after window. The results only
+        // depend on the arguments, not on earlier calls, so separate engines
+        // can work on separate ranges of windows.
+        virtual void analyze(const std::vector<float>& samples,
+                             const size_t* starts,
+                             size_t count,
+                             float* destination) = 0;
+    };
+
+    // A windowed FFT of every frame, in batches
+    class fft_engine : public analysis_engine {
+    private:
+        bucket_table buckets;
+        fft_batch_plan plan;
+        const float* window;
+
+        // Copies of the frames that run past the end of the samples, padded
+        // with silence; all others are read where they are
+        std::vector<float> padded_frames;
+
+    public:
+        fft_engine(const analysis_config_t& _config);
+
+        void analyze(const std::vector<float>& samples,
+                     const size_t* starts,
+                     size_t count,
+                     float* destination);
+    };
+
+    // Updates the bins in the frequency range from one window to the next
+    // with a sliding DFT, so a hop of h samples costs O(h) per bin instead of
+    // a whole FFT. The window is applied in the frequency domain, which needs
+    // its periodic form, and so has to be a cosine sum; the constructor
+    // throws analysis_exception for any other. The unwindowed bins are
+    // recomputed with a full FFT at the start of every analyze() call and
+    // every SLIDING_DFT_RESYNC_INTERVAL windows into it, to keep rounding
+    // errors from building up.
+    class sliding_dft_engine : public analysis_engine {
+    private:
+        bucket_table buckets;
+        real_fft_plan resync_plan;
+        std::vector<float> resync_samples;
+
+        // Cosine-sum coefficients of the window
+        std::vector<float> window_terms;
+
+        // The bins of `buckets` and margin = window_terms.size() - 1 more on
+        // either side, which the window spreads into the range, are tracked
+        int first_bin, end_bin, tracked_first_bin;
+
+        // exp(2 pi i m / N) for 0 <= m < N
+        std::vector<std::complex<double>> roots;
+
+        // State of the tracked bins, and Goertzel filters for the hop
+        std::vector<std::complex<double>> bins;
+        std::vector<double> goertzel_coefficients, goertzel_1, goertzel_2;
+        std::vector<float> magnitudes;
+
+        size_t position;
+
+        float sample_at(const std::vector<float>& samples, size_t index) const;
+        const std::complex<double>& root(long long exponent) const;
+
+        void resync(const std::vector<float>& samples, size_t start);
+        void slide(const std::vector<float>& samples, size_t start);
+
+    public:
+        sliding_dft_engine(const analysis_config_t& _config);
+
+        void analyze(const std::vector<float>& samples,
+                     const size_t* starts,
+                     size_t count,
+                     float* destination);
+    };
+
+    // Evaluates the spectrum only on the points covering the frequency
+    // range. When the frequency step is finer than the FFT bin spacing,
+    // the points are `zoom` times as dense as the bins, so every bucket
+    // sees its own part of the spectrum instead of the same few bins. The
+    // points come from a bank of Goertzel filters, a chirp-z transform or,
+    // without zoom, a plain FFT, whichever takes the fewest operations.
+    class zoom_engine : public analysis_engine {
+    private:
+        enum {
+            METHOD_FFT,
+            METHOD_GOERTZEL,
+            METHOD_CHIRP_Z
+        } method;
+
+        size_t zoom;
+        bucket_table buckets;
+        const float* window;
+
+        std::vector<float> window_samples;
+        std::vector<float> magnitudes;
+
+        std::unique_ptr<real_fft_plan> fft;
+        std::unique_ptr<chirp_z_plan> chirp_z;
+        std::vector<double> goertzel_coefficients, goertzel_1, goertzel_2;
+
+        void goertzel();
+
+    public:
+        zoom_engine(const analysis_config_t& _config);
+
+        size_t get_zoom() const {
+            return zoom;
+        }
+
+        std::string get_method_name() const;
+
+        void analyze(const std::vector<float>& samples,
+                     const size_t* starts,
+                     size_t count,
+                     float* destination);
+    };
+
+    std::vector<std::string> get_analysis_engine_names();
+
+    // Throws analysis_exception for an unknown name
+    std::unique_ptr<analysis_engine> make_analysis_engine(const std::string& name,
+                                                          const analysis_config_t& config);
+}
@@ -0,0 +1,129 @@
+#include "batch.hpp"
+#include "parallel.hpp"
+#include "wav.hpp"
+#include <algorithm>
+#include <chrono>
+
+using namespace wavalyzer;
+using namespace std;
+
+// Windows per analyze() call. The same as a task of stream_analyzer, so
+// that every engine gives the same spectra as it does there.
+const size_t BATCH_CALL_WINDOWS = 512;
+
+batch_analyzer::batch_analyzer(const string& _engine,
+                               const vector<analysis_config_t>& _configs,
+                               size_t _step_ms,
+                               const spectrogram_storage_t& _storage,
+                               size_t threads)
+    : engine(_engine),
+      configs(_configs),
+      step_ms(_step_ms),
+      storage(_storage),
+      thread_count(max<size_t>(1, threads)),
+      workers(thread_count)
+{
+    // Fails early on a bad engine name, rather than once per file
+    vector<string> names = get_analysis_engine_names();
+    if (find(names.begin(), names.end(), engine) == names.end()) {
+        throw analysis_exception("Unknown analysis engine `" + engine + "`");
+    }
+
+    for (worker_t& worker : workers) {
+        worker.spectra = vector<spectrogram_matrix>(configs.size());
+    }
+}
+
+void batch_analyzer::analyze_file(worker_t& worker, const string& filename)
+{
+    wav_file file(filename);
+    file.read_samples(worker.samples, file.get_total_samples());
+
+    size_t sample_rate = file.get_sample_rate();
+    vector<unique_ptr<analysis_engine>>& engines = worker.engines[sample_rate];
+
+    if (engines.empty()) {
+        for (analysis_config_t config : configs) {
+            config.sample_rate = sample_rate;
+            engines.push_back(make_analysis_engine(engine, config));
+        }
+    }
+
+    worker.layouts.clear();
+    uint64_t value_count = 0;
+    for (size_t c = 0; c < configs.size(); c++) {
+        worker.layouts.push_back(get_window_layout(sample_rate, file.get_total_samples(), configs[c].window_size, step_ms));
+        value_count += static_cast<uint64_t>(worker.layouts[c].window_count) * engines[c]->get_bucket_count();
+    }
+
+    // Every thread holds the matrices of one file at a time
+    spectrogram_storage_t share = storage;
+    if (share.memory_budget > 0) {
+        share.memory_budget = max<uint64_t>(1, share.memory_budget / thread_count);
+    }
+    spectrogram_format_t format = choose_spectrogram_format(share, value_count);
+
+    for (size_t c = 0; c < configs.size(); c++) {
+        const window_layout_t& layout = worker.layouts[c];
+        size_t bucket_count = engines[c]->get_bucket_count();
+        spectrogram_matrix& spectra = worker.spectra[c];
+
+        spectra.set_format(format);
+        spectra.resize(layout.window_count, bucket_count);
+
+        for (size_t first = 0; first < layout.window_count; first += BATCH_CALL_WINDOWS) {
+            size_t count = min(BATCH_CALL_WINDOWS, layout.window_count - first);
+
+            worker.starts.resize(count);
+            for (size_t w = 0; w < count; w++) {
+                worker.starts[w] = layout.get_window_start(first + w);
+            }
+
+            worker.buckets.resize(count * bucket_count);
+            engines[c]->analyze(worker.samples, worker.starts.data(), count, worker.buckets.data());
+
+            spectra.set_columns(first, count, worker.buckets.data());
+        }
+    }
+}
+
+batch_stats_t batch_analyzer::run(const vector<string>& filenames,
+                                  const result_callback_t& on_result,
+                                  const error_callback_t& on_error)
+{
+    for (worker_t& worker : workers) {
+        worker.files = 0;
+        worker.samples_read = 0;
+        worker.windows = 0;
+    }
+
+    auto start = chrono::steady_clock::now();
+
+    parallel_for(thread_count, filenames.size(), [&](size_t w, size_t index) {
+        worker_t& worker = workers[w];
+
+        // One bad file does not stop the others
+        try {
+            analyze_file(worker, filenames[index]);
+            on_result(filenames[index], worker.spectra, worker.layouts);
+
+            worker.files++;
+            worker.samples_read += worker.samples.size();
+            for (const window_layout_t& layout : worker.layouts) {
+                worker.windows += layout.window_count;
+            }
+        } catch (exception& e) {
+            on_error(filenames[index], e);
+        }
+    });
+
+    batch_stats_t stats = {0, 0, 0, 0, chrono::duration<double>(chrono::steady_clock::now() - start).count()};
+    for (const worker_t& worker : workers) {
+        stats.files += worker.files;
+        stats.samples += worker.samples_read;
+        stats.windows += worker.windows;
+    }
+
+    stats.failed_files = filenames.size() - stats.files;
+    return stats;
+}
@@ -0,0 +1,70 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <functional>
+#include <exception>
+#include "analysis.hpp"
+#include "spectrogram_matrix.hpp"
+
+namespace wavalyzer {
+    struct batch_stats_t {
+        size_t files, failed_files, samples, windows;
+        double seconds;
+    };
+
+    // Analyzes many files on a shared pool of threads, each file on one
+    // thread from start to end, which suits short files best. Every thread
+    // keeps its engines, with their plans and buffers, for the next file of
+    // the same sample rate, and its matrices for the next file of any.
+    class batch_analyzer {
+    public:
+        // Gets the spectra of a file, one matrix and layout per config, on
+        // the thread that analyzed it. The matrices are reused afterwards.
+        typedef std::function<void(const std::string& filename,
+                                   const std::vector<spectrogram_matrix>& spectra,
+                                   const std::vector<window_layout_t>& layouts)> result_callback_t;
+
+        // Gets a file that could not be analyzed, or whose result callback
+        // threw, and why
+        typedef std::function<void(const std::string& filename, const std::exception& error)> error_callback_t;
+
+    private:
+        struct worker_t {
+            // One engine per config, for each sample rate seen
+            std::map<size_t, std::vector<std::unique_ptr<analysis_engine>>> engines;
+            std::vector<spectrogram_matrix> spectra;
+            std::vector<window_layout_t> layouts;
+            std::vector<float> samples, buckets;
+            std::vector<size_t> starts;
+
+            // Of the files that were analyzed
+            size_t files, samples_read, windows;
+        };
+
+        std::string engine;
+        std::vector<analysis_config_t> configs;
+        size_t step_ms;
+        spectrogram_storage_t storage;
+        size_t thread_count;
+        std::vector<worker_t> workers;
+
+        void analyze_file(worker_t& worker, const std::string& filename);
+
+    public:
+        // The sample rates of the configs are ignored, as every file has its
+        // own. The format of the matrices is chosen per file, with an even
+        // share of the memory budget for every thread. Throws
+        // analysis_exception for an unknown engine name.
+        batch_analyzer(const std::string& _engine,
+                       const std::vector<analysis_config_t>& _configs,
+                       size_t _step_ms,
+                       const spectrogram_storage_t& _storage,
+                       size_t threads);
+
+        batch_stats_t run(const std::vector<std::string>& filenames,
+                          const result_callback_t& on_result,
+                          const error_callback_t& on_error);
+    };
+}
@@ -0,0 +1,392 @@
+#include "cache.hpp"
+#include <fstream>
+#include <vector>
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+#include <cstdio>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+using namespace wavalyzer;
+using namespace std;
+
+// Bump whenever the file layout or the analysis output changes
+const uint32_t CACHE_FORMAT_VERSION = 5;
+const char CACHE_MAGIC[8] = {'W', 'A', 'V', 'C', 'A', 'C', 'H', 'E'};
+const char* const CACHE_EXTENSION = ".wvc";
+
+// The matrix starts on a page of its own, so it can be mapped in place
+const uint64_t CACHE_DATA_ALIGNMENT = 4096;
+
+// hash_pcm_contents checks whether to stop after every this many bytes
+const size_t HASH_SLICE_BYTES = 1 << 20;
+
+// get_content_identity hashes this many pieces of the data chunk, the first
+// at its start and the last at its end
+const size_t IDENTITY_PIECES = 64;
+const size_t IDENTITY_PIECE_BYTES = 4096;
+const uint64_t HASH_MULTIPLIER = 0x9e3779b97f4a7c15ULL;
+
+namespace wavalyzer {
+    struct cache_header_t {
+        char magic[8];
+        uint32_t version;
+        uint32_t header_size;
+        uint64_t key;
+        uint64_t window_count;
+        uint64_t bucket_count;
+        uint64_t row_stride;
+        uint64_t data_offset;
+
+        // A spectrogram_format_t
+        uint64_t format;
+
+        // hash_pcm_contents of the analyzed file
+        uint64_t content_hash;
+    };
+
+    struct cache_entry_t {
+        string filename;
+        uint64_t size;
+        timespec last_used;
+    };
+
+    uint64_t hash_mix(uint64_t state, uint64_t word);
+    void make_directories(const string& path);
+}
+
+uint64_t wavalyzer::hash_mix(uint64_t state, uint64_t word)
+{
+    state = (state ^ word) * HASH_MULTIPLIER;
+    return state ^ (state >> 32);
+}
+
+void wavalyzer::make_directories(const string& path)
+{
+    for (size_t slash = path.find('/', 1); ; slash = path.find('/', slash + 1)) {
+        string prefix = path.substr(0, slash);
+        if (mkdir(prefix.c_str(), 0755) != 0 && errno != EEXIST) {
+            throw cache_exception("Cannot create directory `" + prefix + "`: " + strerror(errno));
+        }
+
+        if (slash == string::npos) {
+            break;
+        }
+    }
+}
+
+content_hasher::content_hasher()
+    : state(0),
+      length(0),
+      pending(0),
+      pending_bytes(0)
+{
+}
+
+void content_hasher::mix(uint64_t word)
+{
+    state = hash_mix(state, word);
+}
+
+void content_hasher::update(const void* data, size_t size)
+{
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    length += size;
+
+    // Finish the word a previous piece left incomplete
+    while (pending_bytes > 0 && size > 0) {
+        pending |= static_cast<uint64_t>(*bytes++) << (8 * pending_bytes++);
+        size--;
+
+        if (pending_bytes == 8) {
+            mix(pending);
+            pending = 0;
+            pending_bytes = 0;
+        }
+    }
+
+    for (; size >= 8; bytes += 8, size -= 8) {
+        uint64_t word;
+        memcpy(&word, bytes, sizeof(word));
+        mix(word);
+    }
+
+    for (; size > 0; size--) {
+        pending |= static_cast<uint64_t>(*bytes++) << (8 * pending_bytes++);
+    }
+}
+
+uint64_t content_hasher::get() const
+{
+    uint64_t result = pending_bytes > 0 ? hash_mix(state, pending) : state;
+    result = hash_mix(result, length);
+    return result ^ (result >> 29);
+}
+
+uint64_t wavalyzer::hash_pcm_contents(const pcm_view_t& pcm, const atomic<bool>& stop)
+{
+    content_hasher hasher;
+    size_t bytes = pcm.count * pcm.bytes_per_sample;
+
+    for (size_t offset = 0; offset < bytes; offset += HASH_SLICE_BYTES) {
+        if (stop) {
+            throw cache_exception("Stopped hashing the samples");
+        }
+
+        hasher.update(pcm.data + offset, min(bytes - offset, HASH_SLICE_BYTES));
+    }
+
+    return hasher.get();
+}
+
+uint64_t wavalyzer::get_content_identity(const wav_file& file)
+{
+    pcm_view_t pcm = file.get_pcm();
+    if (!file.is_mapped()) {
+        throw cache_exception("The file cannot be mapped");
+    }
+
+    size_t bytes = pcm.count * pcm.bytes_per_sample;
+    uint64_t fields[] = {
+        bytes,
+        static_cast<uint64_t>(pcm.format)
+    };
+
+    content_hasher hasher;
+    hasher.update(fields, sizeof(fields));
+
+    if (bytes <= IDENTITY_PIECES * IDENTITY_PIECE_BYTES) {
+        hasher.update(pcm.data, bytes);
+    } else {
+        for (size_t piece = 0; piece < IDENTITY_PIECES; piece++) {
+            size_t offset = (bytes - IDENTITY_PIECE_BYTES) * piece / (IDENTITY_PIECES - 1);
+            hasher.update(pcm.data + offset, IDENTITY_PIECE_BYTES);
+        }
+    }
+
+    return hasher.get();
+}
+
+uint64_t wavalyzer::get_analysis_cache_key(uint64_t content_identity,
+                                           const analysis_config_t& config,
+                                           const string& engine,
+                                           size_t ms_step)
+{
+    uint32_t parameter_bits;
+    memcpy(&parameter_bits, &config.window.parameter, sizeof(parameter_bits));
+
+    uint64_t fields[] = {
+        CACHE_FORMAT_VERSION,
+        content_identity,
+        config.sample_rate,
+        config.window_size,
+        static_cast<uint64_t>(config.window.type),
+        parameter_bits,
+        config.min_hertz,
+        config.max_hertz,
+        config.step_hertz,
+        ms_step,
+        engine.size()
+    };
+
+    content_hasher hasher;
+    hasher.update(fields, sizeof(fields));
+    hasher.update(engine.data(), engine.size());
+
+    return hasher.get();
+}
+
+analysis_cache::analysis_cache(const string& _directory, uint64_t _max_bytes)
+    : directory(_directory),
+      max_bytes(_max_bytes)
+{
+}
+
+string analysis_cache::get_default_directory()
+{
+    const char* xdg_cache_home = getenv("XDG_CACHE_HOME");
+    if (xdg_cache_home != nullptr && *xdg_cache_home != '\0') {
+        return string(xdg_cache_home) + "/wavalyzer";
+    }
+
+    const char* home = getenv("HOME");
+    if (home != nullptr && *home != '\0') {
+        return string(home) + "/.cache/wavalyzer";
+    }
+
+    return "";
+}
+
+string analysis_cache::get_filename(uint64_t key) const
+{
+    char name[17];
+    snprintf(name, sizeof(name), "%016llx", static_cast<unsigned long long>(key));
+
+    return directory + "/" + name + CACHE_EXTENSION;
+}
+
+bool analysis_cache::load(uint64_t key, spectrogram_matrix& spectra, uint64_t& content_hash)
+{
+    string filename = get_filename(key);
+
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || static_cast<size_t>(info.st_size) < sizeof(cache_header_t)) {
+        close(fd);
+        return false;
+    }
+
+    // Private and writable, so that changes to the matrix stay in memory
+    size_t size = info.st_size;
+    void* base = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (base == MAP_FAILED) {
+        return false;
+    }
+
+    cache_header_t header;
+    memcpy(&header, base, sizeof(header));
+
+    // Levels stored in another format than wanted are as good as missing
+    spectrogram_format_t format = spectra.get_format();
+
+    if (memcmp(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) != 0 ||
+        header.version != CACHE_FORMAT_VERSION ||
+        header.header_size != sizeof(cache_header_t) ||
+        header.key != key ||
+        header.format != static_cast<uint64_t>(format) ||
+        header.row_stride != spectrogram_matrix::get_row_stride(header.window_count, format) ||
+        header.data_offset % CACHE_DATA_ALIGNMENT != 0 ||
+        header.data_offset + header.row_stride * header.bucket_count * get_spectrogram_format_size(format) != size) {
+
+        munmap(base, size);
+        return false;
+    }
+
+    spectra.attach(static_cast<char*>(base) + header.data_offset,
+                   header.window_count,
+                   header.bucket_count,
+                   header.row_stride,
+                   format,
+                   [base, size]() { munmap(base, size); });
+
+    content_hash = header.content_hash;
+
+    // Eviction goes by modification time, so this marks the file as used
+    utimensat(AT_FDCWD, filename.c_str(), nullptr, 0);
+
+    return true;
+}
+
+void analysis_cache::store(uint64_t key, uint64_t content_hash, const spectrogram_matrix& spectra)
+{
+    cache_header_t header;
+    memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+    header.version = CACHE_FORMAT_VERSION;
+    header.header_size = sizeof(cache_header_t);
+    header.key = key;
+    header.window_count = spectra.get_window_count();
+    header.bucket_count = spectra.get_bucket_count();
+    header.row_stride = spectra.get_row_stride();
+    header.data_offset = CACHE_DATA_ALIGNMENT;
+    header.format = spectra.get_format();
+    header.content_hash = content_hash;
+
+    size_t value_size = get_spectrogram_format_size(spectra.get_format());
+
+    // An entry that can never fit would only evict everything else
+    if (header.data_offset + header.row_stride * header.bucket_count * value_size > max_bytes) {
+        return;
+    }
+
+    make_directories(directory);
+
+    // Written under another name first, so that a reader never maps a
+    // half-written file
+    string filename = get_filename(key),
+           temporary = filename + ".tmp" + to_string(getpid());
+
+    ofstream file(temporary, ios::binary);
+    if (!file) {
+        throw cache_exception("Cannot create `" + temporary + "`");
+    }
+
+    vector<char> padding(header.data_offset - sizeof(header), 0);
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(padding.data(), padding.size());
+
+    vector<char> row_padding((header.row_stride - header.window_count) * value_size, 0);
+    for (size_t bucket = 0; bucket < header.bucket_count; bucket++) {
+        file.write(reinterpret_cast<const char*>(spectra.get_row_data(bucket)), header.window_count * value_size);
+        file.write(row_padding.data(), row_padding.size());
+    }
+
+    file.close();
+    if (!file || rename(temporary.c_str(), filename.c_str()) != 0) {
+        unlink(temporary.c_str());
+        throw cache_exception("Cannot write `" + filename + "`");
+    }
+
+    evict();
+}
+
+void analysis_cache::remove(uint64_t key)
+{
+    unlink(get_filename(key).c_str());
+}
+
+void analysis_cache::evict()
+{
+    DIR* dir = opendir(directory.c_str());
+    if (dir == nullptr) {
+        return;
+    }
+
+    vector<cache_entry_t> entries;
+    uint64_t total = 0;
+    size_t extension_length = strlen(CACHE_EXTENSION);
+
+    while (dirent* entry = readdir(dir)) {
+        string name = entry->d_name;
+        if (name.size() <= extension_length ||
+            name.compare(name.size() - extension_length, extension_length, CACHE_EXTENSION) != 0) {
+            continue;
+        }
+
+        string filename = directory + "/" + name;
+        struct stat info;
+        if (stat(filename.c_str(), &info) != 0 || !S_ISREG(info.st_mode)) {
+            continue;
+        }
+
+        entries.push_back({filename, static_cast<uint64_t>(info.st_size), info.st_mtim});
+        total += info.st_size;
+    }
+
+    closedir(dir);
+
+    sort(entries.begin(), entries.end(), [](const cache_entry_t& a, const cache_entry_t& b) {
+        return a.last_used.tv_sec != b.last_used.tv_sec ? a.last_used.tv_sec < b.last_used.tv_sec :
+                                                          a.last_used.tv_nsec < b.last_used.tv_nsec;
+    });
+
+    for (const cache_entry_t& entry : entries) {
+        if (total <= max_bytes) {
+            break;
+        }
+
+        if (unlink(entry.filename.c_str()) == 0) {
+            total -= entry.size;
+        }
+    }
+}
@@ -0,0 +1,98 @@
+#pragma once
+#include <string>
+#include <cstdint>
+#include <atomic>
+#include <exception>
+#include "analysis.hpp"
+#include "spectrogram_matrix.hpp"
+#include "wav.hpp"
+
+namespace wavalyzer {
+    class cache_exception : public std::exception {
+    private:
+        std::string message;
+
+    public:
+        cache_exception(const std::string& _message)
+            : message(_message) {}
+
+        cache_exception(const std::string&& _message)
+            : message(std::move(_message)) {}
+
+        virtual const char* what() const throw() {
+            return message.c_str();
+        }
+    };
+
+    // A 64-bit hash of bytes fed in any number of pieces, 8 bytes per step.
+    // Not cryptographic; it only tells recordings and settings apart.
+    class content_hasher {
+    private:
+        std::uint64_t state, length, pending;
+        size_t pending_bytes;
+
+        void mix(std::uint64_t word);
+
+    public:
+        content_hasher();
+
+        void update(const void* data, size_t size);
+        std::uint64_t get() const;
+    };
+
+    // Hashes every sample of a mapped file straight from the mapping, which
+    // takes a while for a large one. Throws cache_exception once `stop` is
+    // set.
+    std::uint64_t hash_pcm_contents(const pcm_view_t& pcm, const std::atomic<bool>& stop);
+
+    // Tells the samples of files apart without reading all of them: by the
+    // size of their data chunk, their sample format, and a hash of evenly
+    // spaced pieces of the mapped chunk. Files with the same samples get
+    // the same identity wherever they are, and it takes the same time for
+    // any size. Throws cache_exception if the file is not mapped.
+    std::uint64_t get_content_identity(const wav_file& file);
+
+    // Identifies the spectra of a file, as get_content_identity tells it,
+    // analyzed with the given settings, one window every ms_step ms
+    std::uint64_t get_analysis_cache_key(std::uint64_t content_identity,
+                                         const analysis_config_t& config,
+                                         const std::string& engine,
+                                         size_t ms_step);
+
+    // Spectrogram matrices saved in a directory, one file per key, in the
+    // same layout as in memory, so that loading one only maps it. Files
+    // start with a versioned header; ones from other versions are treated
+    // as missing. When the files add up to more than max_bytes, the ones
+    // used least recently are deleted.
+    //
+    // Each file also records the hash_pcm_contents of the file it was
+    // analyzed from. Keys are cheap to get, so a hit can be used at once
+    // and checked against that hash later.
+    class analysis_cache {
+    private:
+        std::string directory;
+        std::uint64_t max_bytes;
+
+        std::string get_filename(std::uint64_t key) const;
+        void evict();
+
+    public:
+        analysis_cache(const std::string& _directory, std::uint64_t _max_bytes);
+
+        // $XDG_CACHE_HOME/wavalyzer, or ~/.cache/wavalyzer; empty if
+        // neither variable is set
+        static std::string get_default_directory();
+
+        // Maps the matrix saved for `key` into `spectra`, sets content_hash
+        // to the hash it was saved with and returns true, or returns false
+        // if there is none in the format of `spectra`
+        bool load(std::uint64_t key, spectrogram_matrix& spectra, std::uint64_t& content_hash);
+
+        // Throws cache_exception if the matrix cannot be saved
+        void store(std::uint64_t key, std::uint64_t content_hash, const spectrogram_matrix& spectra);
+
+        // Deletes the matrix saved for `key`, if any. Matrices already
+        // loaded from it stay usable.
+        void remove(std::uint64_t key);
+    };
+}
@@ -1,12 +1,24 @@
 #include "common.hpp"
 #include <cmath>
+#include <cfloat>
+#include <algorithm>
 
 using namespace wavalyzer;
 using namespace std;
 
+float wavalyzer::sample_level_to_db(float sample_level)
+{
+    return 20.0f * log10(max(sample_level, FLT_MIN));
+}
+
+float wavalyzer::db_to_sample_level(float db)
+{
+    return pow(10.0f, db / 20.0f);
+}
+
 float wavalyzer::sample_level_to_dbfs(float sample_level, float noise_floor)
 {
-    float dbfs = 20.0f * log(sample_level);
+    float dbfs = sample_level_to_db(sample_level);
     if (dbfs < noise_floor) {
         return noise_floor;
     }
@@ -2,6 +2,12 @@
 #include <string>
 
 namespace wavalyzer {
+    // 20 log10(sample_level), with silence clamped to the smallest normal
+    // float, which gives about -759 dB
+    float sample_level_to_db(float sample_level);
+    float db_to_sample_level(float db);
+
+    // As sample_level_to_db, but no lower than noise_floor
     float sample_level_to_dbfs(float sample_level, float noise_floor = -96.0f);
     std::string hertz_to_string(int hertz);
 
@@ -0,0 +1,81 @@
+#include "export.hpp"
+#include <fstream>
+#include <vector>
+#include <cstdint>
+#include <cmath>
+
+using namespace wavalyzer;
+using namespace std;
+
+const char SPECTROGRAM_MAGIC[8] = {'W', 'A', 'V', 'S', 'P', 'E', 'C', '1'};
+
+namespace wavalyzer {
+    void write_u64(ostream& file, uint64_t value);
+}
+
+void wavalyzer::write_u64(ostream& file, uint64_t value)
+{
+    // Assuming a little-endian CPU architecture, as wav_file does
+    file.write(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+void wavalyzer::save_spectrogram_matrix(const spectrogram_matrix& spectra,
+                                        const spectrogram_layout_t& layout,
+                                        const string& filename)
+{
+    ofstream file(filename, ios::binary);
+    if (!file) {
+        throw export_exception("Cannot open `" + filename + "` for writing");
+    }
+
+    file.write(SPECTROGRAM_MAGIC, sizeof(SPECTROGRAM_MAGIC));
+    write_u64(file, spectra.get_window_count());
+    write_u64(file, spectra.get_bucket_count());
+    write_u64(file, layout.first_ms);
+    write_u64(file, layout.step_ms);
+    write_u64(file, layout.min_hertz);
+    write_u64(file, layout.step_hertz);
+
+    // Whatever the matrix stores them as
+    vector<float> row(spectra.get_window_count());
+    for (size_t bucket = 0; bucket < spectra.get_bucket_count(); bucket++) {
+        spectra.read_row(bucket, 0, row.size(), row.data());
+        file.write(reinterpret_cast<const char*>(row.data()), row.size() * sizeof(float));
+    }
+
+    if (!file.flush()) {
+        throw export_exception("Cannot write to `" + filename + "`");
+    }
+}
+
+void wavalyzer::save_spectrogram_peaks(const spectrogram_matrix& spectra,
+                                       const spectrogram_layout_t& layout,
+                                       const string& filename)
+{
+    ofstream file(filename);
+    if (!file) {
+        throw export_exception("Cannot open `" + filename + "` for writing");
+    }
+
+    file << "ms\tpeak_hz\tpeak_db\n";
+
+    size_t bucket_count = spectra.get_bucket_count();
+    for (size_t window = 0; window < spectra.get_window_count(); window++) {
+        spectrogram_column column = spectra.get_column(window);
+
+        size_t peak = 0;
+        for (size_t bucket = 1; bucket < bucket_count; bucket++) {
+            if (column[bucket] > column[peak]) {
+                peak = bucket;
+            }
+        }
+
+        file << layout.first_ms + window * layout.step_ms << '\t' <<
+                layout.min_hertz + peak * layout.step_hertz << '\t' <<
+                (bucket_count > 0 ? column[peak] : -INFINITY) << '\n';
+    }
+
+    if (!file.flush()) {
+        throw export_exception("Cannot write to `" + filename + "`");
+    }
+}
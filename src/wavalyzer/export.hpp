@@ -0,0 +1,44 @@
+#pragma once
+#include <string>
+#include <exception>
+#include "spectrogram_matrix.hpp"
+
+namespace wavalyzer {
+    class export_exception : public std::exception {
+    private:
+        std::string message;
+
+    public:
+        export_exception(const std::string& _message)
+            : message(_message) {}
+
+        export_exception(const std::string&& _message)
+            : message(std::move(_message)) {}
+
+        virtual const char* what() const throw() {
+            return message.c_str();
+        }
+    };
+
+    // Where the windows and buckets of a spectrogram_matrix lie: window i
+    // is centered at first_ms + i * step_ms, bucket b starts at
+    // min_hertz + b * step_hertz
+    struct spectrogram_layout_t {
+        size_t first_ms, step_ms;
+        size_t min_hertz, step_hertz;
+    };
+
+    // Writes the matrix as the magic "WAVSPEC1", then window count, bucket
+    // count, first_ms, step_ms, min_hertz and step_hertz as 64-bit
+    // integers, then the dB levels as 32-bit floats, bucket after bucket,
+    // all little-endian
+    void save_spectrogram_matrix(const spectrogram_matrix& spectra,
+                                 const spectrogram_layout_t& layout,
+                                 const std::string& filename);
+
+    // Writes one tab separated line per window with its time in ms, and the
+    // frequency in Hz and level in dB of its loudest bucket
+    void save_spectrogram_peaks(const spectrogram_matrix& spectra,
+                                const spectrogram_layout_t& layout,
+                                const std::string& filename);
+}
@@ -1,14 +1,42 @@
 #include "fft.hpp"
 #include <iostream>
 
-const float PI = 3.14159265359f;
+const double PI = 3.14159265358979323846;
 
 using namespace wavalyzer;
 using namespace std;
 
 namespace wavalyzer {
-    void fft(vector<complex<float>>& samples);
     size_t hertz_to_sample(int hertz, size_t sample_rate, size_t samples);
+    int bucket_lower_bin(size_t hertz, size_t step_hertz, size_t sample_rate, size_t samples);
+    int bucket_upper_bin(size_t hertz, size_t step_hertz, size_t sample_rate, size_t samples);
+    bool bucket_bin_range(size_t sample_rate,
+                          size_t step_hertz,
+                          size_t min_hertz,
+                          size_t max_hertz,
+                          size_t samples,
+                          int last_bin,
+                          int& first_bin,
+                          int& end_bin);
+
+    void compute_bit_reversal(size_t size, vector<size_t>& destination);
+    void compute_stage_twiddles(size_t size, vector<complex<float>>& destination);
+    void compute_unpack_twiddles(size_t size, vector<complex<float>>& destination);
+
+    // The buckets of the batch the plan last transformed
+    void reduce_batch(fft_batch_plan& plan,
+                      const bucket_table& buckets,
+                      size_t frame_count,
+                      float window_normalization_factor,
+                      float* destination);
+
+    // std::complex multiplication goes through a NaN-checking libcall
+    // unless -ffast-math is on, which is far too slow for a butterfly
+    inline complex<float> complex_mul(complex<float> a, complex<float> b)
+    {
+        return complex<float>(a.real() * b.real() - a.imag() * b.imag(),
+                              a.real() * b.imag() + a.imag() * b.real());
+    }
 }
 
 size_t wavalyzer::hertz_to_sample(int hertz, size_t sample_rate, size_t samples)
@@ -16,67 +44,861 @@ size_t wavalyzer::hertz_to_sample(int hertz, size_t sample_rate, size_t samples)
     return hertz * samples / sample_rate;
 }
 
-void wavalyzer::fft(vector<complex<float>>& samples)
+// A bucket centered at `hertz` spans the bins from hertz - step_hertz to
+// hertz + step_hertz, both inclusive
+int wavalyzer::bucket_lower_bin(size_t hertz, size_t step_hertz, size_t sample_rate, size_t samples)
+{
+    int lower_hertz = static_cast<int>(hertz) - static_cast<int>(step_hertz);
+    if (lower_hertz < 0) {
+        lower_hertz = 0;
+    }
+
+    return hertz_to_sample(lower_hertz, sample_rate, samples);
+}
+
+int wavalyzer::bucket_upper_bin(size_t hertz, size_t step_hertz, size_t sample_rate, size_t samples)
+{
+    return hertz_to_sample(static_cast<int>(hertz + step_hertz), sample_rate, samples);
+}
+
+// The range of bins touched by any of the buckets from min_hertz to
+// max_hertz, clamped to the half spectrum. False if there is none.
+bool wavalyzer::bucket_bin_range(size_t sample_rate,
+                                 size_t step_hertz,
+                                 size_t min_hertz,
+                                 size_t max_hertz,
+                                 size_t samples,
+                                 int last_bin,
+                                 int& first_bin,
+                                 int& end_bin)
+{
+    first_bin = bucket_lower_bin(min_hertz, step_hertz, sample_rate, samples);
+    end_bin = bucket_upper_bin(max_hertz, step_hertz, sample_rate, samples);
+
+    if (end_bin > last_bin) {
+        end_bin = last_bin;
+    }
+
+    return first_bin <= end_bin;
+}
+
+bucket_table::bucket_table(size_t sample_rate,
+                           size_t samples,
+                           size_t step_hertz,
+                           size_t min_hertz,
+                           size_t max_hertz,
+                           int last_bin)
+    : bucket_count(wavalyzer::get_bucket_count(step_hertz, min_hertz, max_hertz)),
+      first_bin(0),
+      end_bin(-1)
 {
-    size_t n = samples.size();
-    if (n <= 1) {
+    offsets.push_back(0);
+
+    if (bucket_count == 0 ||
+        !bucket_bin_range(sample_rate, step_hertz, min_hertz, max_hertz, samples,
+                          last_bin, first_bin, end_bin)) {
+        // Nothing in range, or the whole range is above Nyquist: every
+        // bucket is empty and adds up to 0
+        first_bin = 0;
+        end_bin = -1;
+        offsets.resize(bucket_count + 1, 0);
         return;
     }
 
-    vector<complex<float>> even_samples, odd_samples;
-    even_samples.reserve(n / 2);
-    odd_samples.reserve(n / 2);
+    for (size_t hertz = min_hertz; hertz <= max_hertz; hertz += step_hertz) {
+        int lower_bin = bucket_lower_bin(hertz, step_hertz, sample_rate, samples);
+        int upper_bin = bucket_upper_bin(hertz, step_hertz, sample_rate, samples);
+        if (upper_bin > last_bin) {
+            upper_bin = last_bin;
+        }
+
+        // Every bin a bucket touches counts in full
+        for (int bin = lower_bin; bin <= upper_bin; bin++) {
+            bins.push_back(bin - first_bin);
+            weights.push_back(1.0f);
+        }
 
-    for (size_t i = 0; i < n; i += 2) {
-        even_samples.push_back(samples[i]);
-        odd_samples.push_back(samples[i + 1]);
+        offsets.push_back(bins.size());
     }
+}
 
-    fft(even_samples);
-    fft(odd_samples);
+void bucket_table::reduce(const float* magnitudes, float factor, float* destination) const
+{
+    for (size_t bucket = 0; bucket < bucket_count; bucket++) {
+        float sum = 0.0f;
+        for (size_t e = offsets[bucket]; e < offsets[bucket + 1]; e++) {
+            sum += weights[e] * magnitudes[bins[e]];
+        }
 
-    for (size_t i = 0; i < n / 2; i++) {
-        complex<float> T = polar(1.0f, -2.0f * PI * i / n) * odd_samples[i];
-        samples[i] = even_samples[i] + T;
-        samples[i + n / 2] = even_samples[i] - T;
+        destination[bucket] = sum * factor;
     }
 }
 
-fft_result_t wavalyzer::fft_from_samples(const vector<float>& samples,
-                                         size_t sample_rate,
-                                         size_t step_hertz,
-                                         size_t min_hertz,
-                                         size_t max_hertz,
-                                         float window_normalization_factor)
+void bucket_table::reduce_batch(const float* magnitudes,
+                                size_t frame_count,
+                                float factor,
+                                float* sums,
+                                float* destination) const
 {
-    vector<complex<float>> samples_c;
-    samples_c.reserve(samples.size());
+    // Sums run across frames in the inner loop, in the same order as
+    // reduce adds up each frame
+    for (size_t bucket = 0; bucket < bucket_count; bucket++) {
+        fill(sums, sums + frame_count, 0.0f);
+        for (size_t e = offsets[bucket]; e < offsets[bucket + 1]; e++) {
+            const float* row = magnitudes + bins[e] * frame_count;
+            float weight = weights[e];
+            for (size_t f = 0; f < frame_count; f++) {
+                sums[f] += weight * row[f];
+            }
+        }
 
-    for (float f : samples) {
-        samples_c.push_back(f);
+        for (size_t f = 0; f < frame_count; f++) {
+            destination[f * bucket_count + bucket] = sums[f] * factor;
+        }
     }
+}
 
-    fft(samples_c);
+size_t wavalyzer::get_bucket_count(size_t step_hertz, size_t min_hertz, size_t max_hertz)
+{
+    if (min_hertz > max_hertz) {
+        return 0;
+    }
 
-    fft_result_t res;
-    float factor = 1.0f * window_normalization_factor / samples.size();
+    return (max_hertz - min_hertz) / step_hertz + 1;
+}
 
-    for (size_t hertz = min_hertz; hertz <= max_hertz; hertz += step_hertz) {
-        int lower_hertz = static_cast<int>(hertz) - static_cast<int>(step_hertz);
-        int upper_hertz = static_cast<int>(hertz) + static_cast<int>(step_hertz);
+void wavalyzer::compute_bit_reversal(size_t size, vector<size_t>& destination)
+{
+    destination.resize(size);
 
-        int lower_sample = hertz_to_sample(lower_hertz, sample_rate, samples.size());
-        int upper_sample = hertz_to_sample(upper_hertz, sample_rate, samples.size());
+    size_t bits = 0;
+    while ((static_cast<size_t>(1) << bits) < size) {
+        bits++;
+    }
 
-        // Take the max for each bucket
-        float sum = 0.0f;
-        for (int sample = lower_sample; sample <= upper_sample; sample++) {
-            sum += abs(samples_c[sample]);
+    for (size_t i = 0; i < size; i++) {
+        size_t reversed = 0;
+        for (size_t b = 0; b < bits; b++) {
+            if (i & (static_cast<size_t>(1) << b)) {
+                reversed |= static_cast<size_t>(1) << (bits - 1 - b);
+            }
         }
 
-        res.push_back(sum * factor);
+        destination[i] = reversed;
     }
+}
+
+// The stage combining transforms of length `half` into ones of length
+// 2 * half needs the twiddles exp(-2 pi i j / (2 * half)) for
+// 0 <= j < half. Storing them at offset half - 1 keeps every stage's
+// factors contiguous and the whole table exactly size - 1 long.
+void wavalyzer::compute_stage_twiddles(size_t size, vector<complex<float>>& destination)
+{
+    destination.resize(size - 1);
+
+    for (size_t half = 1; half < size; half *= 2) {
+        for (size_t j = 0; j < half; j++) {
+            // Shared with the compile-time tables, so both paths agree
+            double re = 0.0, im = 0.0;
+            fixed_fft_twiddle(j, half, re, im);
+            destination[half - 1 + j] = complex<float>(re, im);
+        }
+    }
+}
+
+void wavalyzer::compute_unpack_twiddles(size_t size, vector<complex<float>>& destination)
+{
+    destination.resize(size / 2 + 1);
+
+    for (size_t k = 0; k <= size / 2; k++) {
+        complex<double> w = polar(1.0, -2.0 * PI * k / size);
+        destination[k] = complex<float>(w);
+    }
+}
+
+fft_plan::fft_plan(size_t _size) : size(_size),
+                                   kernels(&get_fft_kernels()),
+                                   buffer(_size),
+                                   fixed_transform(nullptr)
+{
+    if (size == 0) {
+        throw fft_exception("FFT size must be positive");
+    }
+
+    if ((size & (size - 1)) == 0) {
+        build_radix2();
+    } else if (!build_mixed_radix()) {
+        build_bluestein();
+    }
+}
+
+void fft_plan::build_radix2()
+{
+    size_t log2_size = fixed_fft_log2(size);
+    if (log2_size >= FIXED_FFT_MIN_LOG2 && log2_size <= FIXED_FFT_MAX_LOG2) {
+        algorithm = ALGORITHM_FIXED;
+        fixed_transform = kernels->fixed_fft[log2_size - FIXED_FFT_MIN_LOG2];
+        return;
+    }
+
+    algorithm = ALGORITHM_RADIX2;
+    compute_bit_reversal(size, bit_reversal);
+    compute_stage_twiddles(size, twiddles);
+}
+
+bool fft_plan::build_mixed_radix()
+{
+    // Radix 4 first, as it needs the fewest multiplications per point
+    const size_t RADICES[] = { 4, 2, 3, 5 };
+
+    size_t remaining = size;
+    for (size_t radix : RADICES) {
+        while (remaining % radix == 0) {
+            remaining /= radix;
+            factors.push_back(radix);
+            factors.push_back(remaining);
+        }
+    }
+
+    if (remaining != 1) {
+        factors.clear();
+        return false;
+    }
+
+    algorithm = ALGORITHM_MIXED_RADIX;
+    scratch.resize(size);
+    twiddles.resize(size);
+    for (size_t k = 0; k < size; k++) {
+        complex<double> w = polar(1.0, -2.0 * PI * k / size);
+        twiddles[k] = complex<float>(w);
+    }
+
+    return true;
+}
+
+void fft_plan::build_bluestein()
+{
+    algorithm = ALGORITHM_BLUESTEIN;
+
+    // A length n DFT is a convolution of the input, premultiplied by the
+    // chirp exp(-pi i k^2 / n), with the chirp's conjugate. Doing that
+    // convolution cyclically without wrap-around takes at least 2n - 1
+    // points; a power of two that large runs on the fast path.
+    size_t convolution_size = 1;
+    while (convolution_size < 2 * size - 1) {
+        convolution_size *= 2;
+    }
+
+    convolution_plan = make_unique<fft_plan>(convolution_size);
+
+    // k^2 is reduced modulo 2n first, as the angles would otherwise lose
+    // all precision for large k
+    chirp.resize(size);
+    for (size_t k = 0; k < size; k++) {
+        size_t k2 = (k * k) % (2 * size);
+        complex<double> w = polar(1.0, -PI * k2 / size);
+        chirp[k] = complex<float>(w);
+    }
+
+    chirp_spectrum.assign(convolution_size, complex<float>(0.0f, 0.0f));
+    chirp_spectrum[0] = conj(chirp[0]);
+    for (size_t k = 1; k < size; k++) {
+        chirp_spectrum[k] = conj(chirp[k]);
+        chirp_spectrum[convolution_size - k] = conj(chirp[k]);
+    }
+
+    convolution_plan->execute(&chirp_spectrum[0]);
+}
+
+void fft_plan::execute(complex<float>* data)
+{
+    switch (algorithm) {
+    case ALGORITHM_RADIX2: execute_radix2(data); break;
+    case ALGORITHM_MIXED_RADIX: execute_mixed_radix(data); break;
+    case ALGORITHM_BLUESTEIN: execute_bluestein(data); break;
+    case ALGORITHM_FIXED: fixed_transform(reinterpret_cast<float*>(data)); break;
+    }
+}
+
+void fft_plan::execute_radix2(complex<float>* data)
+{
+    for (size_t i = 0; i < size; i++) {
+        size_t j = bit_reversal[i];
+        if (i < j) {
+            swap(data[i], data[j]);
+        }
+    }
+
+    float* values = reinterpret_cast<float*>(data);
+    const float* w = reinterpret_cast<const float*>(&twiddles[0]);
+
+    size_t stages = 0;
+    while ((static_cast<size_t>(1) << stages) < size) {
+        stages++;
+    }
+
+    // Stages go pairwise through the radix-4 kernel; an odd one out is
+    // done first, where its twiddles are all 1
+    size_t half = 1;
+    if (stages % 2 == 1) {
+        kernels->radix2_pass(values, size, half, w);
+        half *= 2;
+    }
+
+    for (; half < size; half *= 4) {
+        kernels->radix4_pass(values, size, half, w + 2 * (half - 1), w + 2 * (2 * half - 1));
+    }
+}
+
+void fft_plan::execute_mixed_radix(complex<float>* data)
+{
+    copy(data, data + size, scratch.begin());
+    mixed_radix_work(data, &scratch[0], 1, &factors[0]);
+}
+
+// Decimation in time: splits the `radix * m` inputs read every `stride`
+// values into `radix` interleaved subsequences, transforms each of those
+// into consecutive runs of `out`, then combines the runs with one
+// butterfly of the current radix per output index
+void fft_plan::mixed_radix_work(complex<float>* out,
+                                const complex<float>* in,
+                                size_t stride,
+                                const size_t* factor)
+{
+    size_t radix = factor[0], m = factor[1];
+
+    if (m == 1) {
+        for (size_t k = 0; k < radix; k++) {
+            out[k] = in[k * stride];
+        }
+    } else {
+        for (size_t k = 0; k < radix; k++) {
+            mixed_radix_work(out + k * m, in + k * stride, stride * radix, factor + 2);
+        }
+    }
+
+    switch (radix) {
+    case 2: butterfly2(out, stride, m); break;
+    case 3: butterfly3(out, stride, m); break;
+    case 4: butterfly4(out, stride, m); break;
+    case 5: butterfly5(out, stride, m); break;
+    }
+}
+
+void fft_plan::butterfly2(complex<float>* out, size_t stride, size_t m)
+{
+    for (size_t k = 0; k < m; k++) {
+        complex<float> t = complex_mul(out[k + m], twiddles[k * stride]);
+        out[k + m] = out[k] - t;
+        out[k] += t;
+    }
+}
+
+void fft_plan::butterfly3(complex<float>* out, size_t stride, size_t m)
+{
+    // Imaginary part of exp(-2 pi i / 3)
+    float w_imag = twiddles[stride * m].imag();
+
+    for (size_t k = 0; k < m; k++) {
+        complex<float> s1 = complex_mul(out[k + m], twiddles[k * stride]),
+                       s2 = complex_mul(out[k + 2 * m], twiddles[2 * k * stride]);
+
+        complex<float> sum = s1 + s2,
+                       diff = (s1 - s2) * w_imag,
+                       mid = out[k] - 0.5f * sum;
+
+        out[k] += sum;
+        out[k + m] = complex<float>(mid.real() - diff.imag(), mid.imag() + diff.real());
+        out[k + 2 * m] = complex<float>(mid.real() + diff.imag(), mid.imag() - diff.real());
+    }
+}
+
+void fft_plan::butterfly4(complex<float>* out, size_t stride, size_t m)
+{
+    for (size_t k = 0; k < m; k++) {
+        complex<float> s0 = complex_mul(out[k + m], twiddles[k * stride]),
+                       s1 = complex_mul(out[k + 2 * m], twiddles[2 * k * stride]),
+                       s2 = complex_mul(out[k + 3 * m], twiddles[3 * k * stride]);
+
+        complex<float> a = out[k] + s1,
+                       b = out[k] - s1,
+                       c = s0 + s2,
+                       d = s0 - s2;
+
+        // d is rotated by -i for the forward transform
+        out[k] = a + c;
+        out[k + 2 * m] = a - c;
+        out[k + m] = complex<float>(b.real() + d.imag(), b.imag() - d.real());
+        out[k + 3 * m] = complex<float>(b.real() - d.imag(), b.imag() + d.real());
+    }
+}
+
+void fft_plan::butterfly5(complex<float>* out, size_t stride, size_t m)
+{
+    // exp(-2 pi i / 5) and exp(-4 pi i / 5)
+    complex<float> ya = twiddles[stride * m],
+                   yb = twiddles[2 * stride * m];
+
+    for (size_t k = 0; k < m; k++) {
+        complex<float> s0 = out[k],
+                       s1 = complex_mul(out[k + m], twiddles[k * stride]),
+                       s2 = complex_mul(out[k + 2 * m], twiddles[2 * k * stride]),
+                       s3 = complex_mul(out[k + 3 * m], twiddles[3 * k * stride]),
+                       s4 = complex_mul(out[k + 4 * m], twiddles[4 * k * stride]);
+
+        complex<float> sum14 = s1 + s4,
+                       diff14 = s1 - s4,
+                       sum23 = s2 + s3,
+                       diff23 = s2 - s3;
+
+        out[k] = s0 + sum14 + sum23;
+
+        complex<float> near = s0 + sum14 * ya.real() + sum23 * yb.real(),
+                       near_rot(diff14.imag() * ya.imag() + diff23.imag() * yb.imag(),
+                                -diff14.real() * ya.imag() - diff23.real() * yb.imag());
+
+        out[k + m] = near - near_rot;
+        out[k + 4 * m] = near + near_rot;
+
+        complex<float> far = s0 + sum14 * yb.real() + sum23 * ya.real(),
+                       far_rot(-diff14.imag() * yb.imag() + diff23.imag() * ya.imag(),
+                               diff14.real() * yb.imag() - diff23.real() * ya.imag());
+
+        out[k + 2 * m] = far + far_rot;
+        out[k + 3 * m] = far - far_rot;
+    }
+}
+
+void fft_plan::execute_bluestein(complex<float>* data)
+{
+    size_t convolution_size = convolution_plan->get_size();
+    complex<float>* a = convolution_plan->get_buffer();
+
+    for (size_t k = 0; k < size; k++) {
+        a[k] = complex_mul(data[k], chirp[k]);
+    }
+
+    fill(a + size, a + convolution_size, complex<float>(0.0f, 0.0f));
+
+    convolution_plan->execute(a);
+
+    // Multiply the spectra and transform back, computing the inverse FFT
+    // as the conjugate of the forward FFT of the conjugate
+    for (size_t k = 0; k < convolution_size; k++) {
+        a[k] = conj(complex_mul(a[k], chirp_spectrum[k]));
+    }
+
+    convolution_plan->execute(a);
+
+    float scale = 1.0f / convolution_size;
+    for (size_t k = 0; k < size; k++) {
+        data[k] = complex_mul(conj(a[k]) * scale, chirp[k]);
+    }
+}
+
+real_fft_plan::real_fft_plan(size_t _size) : size(_size),
+                                             packed(_size % 2 == 0),
+                                             complex_plan(_size % 2 == 0 ? _size / 2 : _size),
+                                             spectrum(_size / 2 + 1),
+                                             magnitudes(_size / 2 + 1)
+{
+    if (size < 2) {
+        throw fft_exception("Real FFT size must be at least 2");
+    }
+
+    compute_unpack_twiddles(size, unpack_twiddles);
+}
+
+const complex<float>* real_fft_plan::execute(const float* samples)
+{
+    complex<float>* z = complex_plan.get_buffer();
+
+    if (!packed) {
+        for (size_t i = 0; i < size; i++) {
+            z[i] = complex<float>(samples[i], 0.0f);
+        }
+    } else {
+        for (size_t i = 0; i < size / 2; i++) {
+            z[i] = complex<float>(samples[2 * i], samples[2 * i + 1]);
+        }
+    }
+
+    return transform();
+}
+
+const complex<float>* real_fft_plan::execute(const float* samples, const float* window)
+{
+    complex<float>* z = complex_plan.get_buffer();
+
+    if (!packed) {
+        for (size_t i = 0; i < size; i++) {
+            z[i] = complex<float>(samples[i] * window[i], 0.0f);
+        }
+    } else {
+        for (size_t i = 0; i < size / 2; i++) {
+            z[i] = complex<float>(samples[2 * i] * window[2 * i],
+                                  samples[2 * i + 1] * window[2 * i + 1]);
+        }
+    }
+
+    return transform();
+}
+
+const complex<float>* real_fft_plan::transform()
+{
+    complex<float>* z = complex_plan.get_buffer();
+    complex_plan.execute(z);
+
+    if (!packed) {
+        copy(z, z + spectrum.size(), spectrum.begin());
+        return &spectrum[0];
+    }
+
+    // With Z the transform of the packed sequence, the transforms of the
+    // even and odd samples are E[k] = (Z[k] + conj(Z[half - k])) / 2 and
+    // O[k] = (Z[k] - conj(Z[half - k])) / 2i, and X[k] = E[k] + W^k O[k].
+    size_t half = size / 2;
+    for (size_t k = 0; k <= half; k++) {
+        complex<float> zk = z[k == half ? 0 : k],
+                       zc = conj(z[k == 0 ? 0 : half - k]);
+
+        complex<float> even = 0.5f * (zk + zc),
+                       diff = zk - zc,
+                       odd(0.5f * diff.imag(), -0.5f * diff.real());
+
+        spectrum[k] = even + complex_mul(unpack_twiddles[k], odd);
+    }
+
+    return &spectrum[0];
+}
+
+const float* real_fft_plan::get_magnitudes(size_t first_bin, size_t count)
+{
+    complex_plan.get_kernels().magnitudes(reinterpret_cast<const float*>(&spectrum[first_bin]),
+                                          count,
+                                          &magnitudes[first_bin]);
+
+    return &magnitudes[first_bin];
+}
+
+chirp_z_plan::chirp_z_plan(size_t _size, size_t _grid_size, size_t _first_point, size_t _count)
+    : size(_size),
+      grid_size(_grid_size),
+      first_point(_first_point),
+      count(_count),
+      points(_count),
+      magnitudes(_count)
+{
+    if (size == 0 || count == 0) {
+        throw fft_exception("Chirp-z transform needs samples and points");
+    }
+
+    // With theta = 2 pi / grid_size, nk = (n^2 + k^2 - (k - n)^2) / 2 turns
+    //   X[first + k] = sum_n x[n] exp(-i theta (first + k) n)
+    // into a convolution of x[n] exp(-i theta (first n + n^2 / 2)) with
+    // exp(i theta m^2 / 2) for -size < m < count, followed by a
+    // multiplication with exp(-i theta k^2 / 2)
+    size_t convolution_size = 1;
+    while (convolution_size < size + count - 1) {
+        convolution_size *= 2;
+    }
+
+    convolution_plan = make_unique<fft_plan>(convolution_size);
+
+    // Angles are reduced modulo 2 pi in integer arithmetic, in units of
+    // pi / grid_size, to keep their precision for large n
+    size_t period = 2 * grid_size;
+    auto half_chirp = [period, this](size_t m, size_t offset) {
+        size_t units = ((m % period) * (m % period) + 2 * ((offset * m) % period)) % period;
+        return complex<float>(polar(1.0, PI * units / grid_size));
+    };
+
+    input_chirp.resize(size);
+    for (size_t n = 0; n < size; n++) {
+        input_chirp[n] = conj(half_chirp(n, first_point));
+    }
+
+    output_chirp.resize(count);
+    for (size_t k = 0; k < count; k++) {
+        output_chirp[k] = conj(half_chirp(k, 0));
+    }
+
+    chirp_spectrum.assign(convolution_size, complex<float>(0.0f, 0.0f));
+    for (size_t m = 0; m < count; m++) {
+        chirp_spectrum[m] = half_chirp(m, 0);
+    }
+
+    for (size_t m = 1; m < size; m++) {
+        chirp_spectrum[convolution_size - m] = half_chirp(m, 0);
+    }
+
+    convolution_plan->execute(&chirp_spectrum[0]);
+}
+
+const complex<float>* chirp_z_plan::execute(const float* samples)
+{
+    size_t convolution_size = convolution_plan->get_size();
+    complex<float>* a = convolution_plan->get_buffer();
+
+    for (size_t n = 0; n < size; n++) {
+        a[n] = input_chirp[n] * samples[n];
+    }
+
+    fill(a + size, a + convolution_size, complex<float>(0.0f, 0.0f));
+
+    convolution_plan->execute(a);
+
+    // Same inverse transform as in fft_plan::execute_bluestein
+    for (size_t k = 0; k < convolution_size; k++) {
+        a[k] = conj(complex_mul(a[k], chirp_spectrum[k]));
+    }
+
+    convolution_plan->execute(a);
+
+    float scale = 1.0f / convolution_size;
+    for (size_t k = 0; k < count; k++) {
+        points[k] = complex_mul(conj(a[k]) * scale, output_chirp[k]);
+    }
+
+    return &points[0];
+}
+
+const float* chirp_z_plan::get_magnitudes()
+{
+    convolution_plan->get_kernels().magnitudes(reinterpret_cast<const float*>(&points[0]),
+                                               count,
+                                               &magnitudes[0]);
+
+    return &magnitudes[0];
+}
+
+fft_batch_plan::fft_batch_plan(size_t _size, size_t _batch_size) : size(_size),
+                                                                   batch_size(_batch_size),
+                                                                   frame_count(0),
+                                                                   kernels(&get_fft_kernels()),
+                                                                   frame_plan(_size),
+                                                                   spectrum_re((_size / 2 + 1) * _batch_size),
+                                                                   spectrum_im((_size / 2 + 1) * _batch_size),
+                                                                   magnitudes((_size / 2 + 1) * _batch_size),
+                                                                   sums(_batch_size)
+{
+    size_t half = size / 2;
+    batched = size % 2 == 0 && (half & (half - 1)) == 0;
+
+    if (batched) {
+        compute_bit_reversal(half, bit_reversal);
+        compute_stage_twiddles(half, twiddles);
+        compute_unpack_twiddles(size, unpack_twiddles);
+
+        re.resize(half * batch_size);
+        im.resize(half * batch_size);
+    }
+}
+
+void fft_batch_plan::execute(const float* frames, size_t count)
+{
+    if (count > batch_size) {
+        throw fft_exception("Too many frames for the FFT batch");
+    }
+
+    frame_count = count;
+    size_t n = count;
+
+    if (!batched) {
+        for (size_t f = 0; f < n; f++) {
+            const complex<float>* bins = frame_plan.execute(frames + f * size);
+            for (size_t k = 0; k < get_bin_count(); k++) {
+                spectrum_re[k * n + f] = bins[k].real();
+                spectrum_im[k * n + f] = bins[k].imag();
+            }
+        }
+
+        return;
+    }
+
+    // Pack pairs of real samples into complex values, transposing the batch
+    // and applying the bit-reversal permutation on the way in
+    size_t half = size / 2;
+    for (size_t f = 0; f < n; f++) {
+        const float* samples = frames + f * size;
+        for (size_t j = 0; j < half; j++) {
+            size_t i = bit_reversal[j] * n + f;
+            re[i] = samples[2 * j];
+            im[i] = samples[2 * j + 1];
+        }
+    }
+
+    transform();
+}
+
+void fft_batch_plan::execute(const float* const* frames, size_t count, const float* window)
+{
+    if (count > batch_size) {
+        throw fft_exception("Too many frames for the FFT batch");
+    }
+
+    frame_count = count;
+    size_t n = count;
+
+    if (!batched) {
+        for (size_t f = 0; f < n; f++) {
+            const complex<float>* bins = frame_plan.execute(frames[f], window);
+            for (size_t k = 0; k < get_bin_count(); k++) {
+                spectrum_re[k * n + f] = bins[k].real();
+                spectrum_im[k * n + f] = bins[k].imag();
+            }
+        }
+
+        return;
+    }
+
+    for (size_t f = 0; f < n; f++) {
+        kernels->batch_window_pack(frames[f], window, size / 2, &bit_reversal[0], n, f, &re[0], &im[0]);
+    }
+
+    transform();
+}
+
+void fft_batch_plan::transform()
+{
+    size_t half = size / 2,
+           n = frame_count;
+
+    const float* w = reinterpret_cast<const float*>(&twiddles[0]);
+
+    size_t stages = 0;
+    while ((static_cast<size_t>(1) << stages) < half) {
+        stages++;
+    }
+
+    // Same stage order as fft_plan::execute_radix2
+    size_t stage = 1;
+    if (stages % 2 == 1) {
+        kernels->batch_radix2_pass(&re[0], &im[0], half, n, stage, w);
+        stage *= 2;
+    }
+
+    for (; stage < half; stage *= 4) {
+        kernels->batch_radix4_pass(&re[0], &im[0], half, n, stage,
+                                   w + 2 * (stage - 1), w + 2 * (2 * stage - 1));
+    }
+}
+
+void fft_batch_plan::unpack(size_t first_bin, size_t count)
+{
+    size_t n = frame_count,
+           half = size / 2;
+
+    // Same unpacking as real_fft_plan::execute, written out per component
+    // so that the loop over frames vectorizes and rounds identically
+    for (size_t k = first_bin; k < first_bin + count; k++) {
+        const float* zk_re = &re[(k == half ? 0 : k) * n];
+        const float* zk_im = &im[(k == half ? 0 : k) * n];
+        const float* zc_re = &re[(k == 0 ? 0 : half - k) * n];
+        const float* zc_im = &im[(k == 0 ? 0 : half - k) * n];
+        float* x_re = &spectrum_re[k * n];
+        float* x_im = &spectrum_im[k * n];
+        float w_re = unpack_twiddles[k].real(), w_im = unpack_twiddles[k].imag();
+
+        // zc is conjugated, hence the flipped signs on its imaginary part
+        for (size_t f = 0; f < n; f++) {
+            float even_re = 0.5f * (zk_re[f] + zc_re[f]),
+                  even_im = 0.5f * (zk_im[f] - zc_im[f]),
+                  diff_re = zk_re[f] - zc_re[f],
+                  diff_im = zk_im[f] + zc_im[f],
+                  odd_re = 0.5f * diff_im,
+                  odd_im = -0.5f * diff_re;
+
+            x_re[f] = even_re + (w_re * odd_re - w_im * odd_im);
+            x_im[f] = even_im + (w_re * odd_im + w_im * odd_re);
+        }
+    }
+}
+
+const float* fft_batch_plan::get_magnitudes(size_t first_bin, size_t count)
+{
+    // Only the bins asked for get unpacked from the half-size transform
+    if (batched) {
+        unpack(first_bin, count);
+    }
+
+    size_t offset = first_bin * frame_count;
+    kernels->split_magnitudes(&spectrum_re[offset],
+                              &spectrum_im[offset],
+                              count * frame_count,
+                              &magnitudes[offset]);
+
+    return &magnitudes[offset];
+}
+
+fft_result_t wavalyzer::fft_from_samples(real_fft_plan& plan,
+                                         const bucket_table& buckets,
+                                         const vector<float>& samples,
+                                         float window_normalization_factor)
+{
+    if (samples.size() != plan.get_size()) {
+        throw fft_exception("Sample count does not match the FFT plan size");
+    }
+
+    plan.execute(&samples[0]);
+
+    fft_result_t res(buckets.get_bucket_count(), 0.0f);
+    if (res.empty()) {
+        return res;
+    }
+
+    float factor = 1.0f * window_normalization_factor / samples.size();
+
+    // Every bin any bucket touches gets its magnitude computed once, in a
+    // single vectorized pass
+    const float* magnitudes = buckets.get_bin_count() == 0 ? nullptr :
+                              plan.get_magnitudes(buckets.get_first_bin(), buckets.get_bin_count());
+
+    buckets.reduce(magnitudes, factor, &res[0]);
 
     return res;
 }
 
+void wavalyzer::fft_from_samples_batch(fft_batch_plan& plan,
+                                       const bucket_table& buckets,
+                                       const float* frames,
+                                       size_t frame_count,
+                                       float window_normalization_factor,
+                                       float* destination)
+{
+    if (frame_count == 0 || buckets.get_bucket_count() == 0) {
+        return;
+    }
+
+    plan.execute(frames, frame_count);
+    reduce_batch(plan, buckets, frame_count, window_normalization_factor, destination);
+}
+
+void wavalyzer::fft_from_samples_batch(fft_batch_plan& plan,
+                                       const bucket_table& buckets,
+                                       const float* const* frames,
+                                       size_t frame_count,
+                                       const float* window,
+                                       float window_normalization_factor,
+                                       float* destination)
+{
+    if (frame_count == 0 || buckets.get_bucket_count() == 0) {
+        return;
+    }
+
+    plan.execute(frames, frame_count, window);
+    reduce_batch(plan, buckets, frame_count, window_normalization_factor, destination);
+}
+
+void wavalyzer::reduce_batch(fft_batch_plan& plan,
+                             const bucket_table& buckets,
+                             size_t frame_count,
+                             float window_normalization_factor,
+                             float* destination)
+{
+    float factor = 1.0f * window_normalization_factor / plan.get_size();
+    const float* magnitudes = buckets.get_bin_count() == 0 ? nullptr :
+                              plan.get_magnitudes(buckets.get_first_bin(), buckets.get_bin_count());
+
+    buckets.reduce_batch(magnitudes, frame_count, factor, plan.get_scratch(), destination);
+}
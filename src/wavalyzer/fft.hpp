@@ -1,16 +1,312 @@
 #pragma once
 #include <vector>
 #include <complex>
+#include <memory>
+#include <string>
+#include <exception>
+#include "fft_kernels.hpp"
 
 namespace wavalyzer {
     typedef std::vector<float> fft_result_t;
 
-    fft_result_t fft_from_samples(const std::vector<float>& samples,
-                                  size_t sample_rate,
-                                  size_t step_hertz,
-                                  size_t min_hertz,
-                                  size_t max_hertz,
+    class fft_exception : public std::exception {
+    private:
+        std::string message;
+
+    public:
+        fft_exception(const std::string& _message)
+            : message(_message) {}
+
+        virtual const char* what() const throw() {
+            return message.c_str();
+        }
+    };
+
+    // Everything needed to run an FFT of a fixed size, computed once up
+    // front, plus the scratch space the transform runs in. Plans are meant
+    // to be built once per window size and reused for every frame, so
+    // executing one never allocates.
+    //
+    // Powers of two use bit reversal followed by radix-2/4 passes on
+    // whichever kernels were selected when the plan was built. Other sizes
+    // made only of the factors 2, 3 and 5 use a mixed-radix decomposition,
+    // and anything with a larger prime factor goes through Bluestein's
+    // chirp-z convolution on a power-of-two plan.
+    class fft_plan {
+    private:
+        enum algorithm_t {
+            ALGORITHM_RADIX2,
+            ALGORITHM_MIXED_RADIX,
+            ALGORITHM_BLUESTEIN,
+            ALGORITHM_FIXED
+        };
+
+        size_t size;
+        algorithm_t algorithm;
+        const fft_kernels_t* kernels;
+        std::vector<std::complex<float>> buffer;
+
+        // Power of two sizes with a compile-time instantiation need nothing
+        // else
+        void (*fixed_transform)(float* data);
+
+        // Radix-2: the permutation, and each stage's twiddles contiguously.
+        // Mixed radix: exp(-2 pi i k / size) for all k.
+        std::vector<size_t> bit_reversal;
+        std::vector<std::complex<float>> twiddles;
+
+        // Mixed radix: (radix, remaining length) pairs, outermost first
+        std::vector<size_t> factors;
+        std::vector<std::complex<float>> scratch;
+
+        // Bluestein: the chirp, the transform of its conjugate padded to
+        // the convolution length, and the plan for that length
+        std::unique_ptr<fft_plan> convolution_plan;
+        std::vector<std::complex<float>> chirp;
+        std::vector<std::complex<float>> chirp_spectrum;
+
+        void build_radix2();
+        bool build_mixed_radix();
+        void build_bluestein();
+
+        void execute_radix2(std::complex<float>* data);
+        void execute_mixed_radix(std::complex<float>* data);
+        void execute_bluestein(std::complex<float>* data);
+
+        void mixed_radix_work(std::complex<float>* out,
+                              const std::complex<float>* in,
+                              size_t stride,
+                              const size_t* factor);
+
+        void butterfly2(std::complex<float>* out, size_t stride, size_t m);
+        void butterfly3(std::complex<float>* out, size_t stride, size_t m);
+        void butterfly4(std::complex<float>* out, size_t stride, size_t m);
+        void butterfly5(std::complex<float>* out, size_t stride, size_t m);
+
+    public:
+        fft_plan(size_t _size);
+
+        size_t get_size() const {
+            return size;
+        }
+
+        std::complex<float>* get_buffer() {
+            return &buffer[0];
+        }
+
+        const fft_kernels_t& get_kernels() const {
+            return *kernels;
+        }
+
+        // Transforms `size` complex values in place
+        void execute(std::complex<float>* data);
+    };
+
+    // Transform of real input. An even number of samples is packed pairwise
+    // into an N/2 point complex FFT, whose output is then unpacked; an odd
+    // number runs as a full complex FFT. Either way only the N/2 + 1
+    // non-redundant bins are produced, as the rest of the spectrum is their
+    // mirror image.
+    class real_fft_plan {
+    private:
+        size_t size;
+        bool packed;
+        fft_plan complex_plan;
+        std::vector<std::complex<float>> unpack_twiddles;
+        std::vector<std::complex<float>> spectrum;
+        std::vector<float> magnitudes;
+
+        // Transforms the samples packed into the buffer of complex_plan
+        const std::complex<float>* transform();
+
+    public:
+        real_fft_plan(size_t _size);
+
+        size_t get_size() const {
+            return size;
+        }
+
+        size_t get_bin_count() const {
+            return size / 2 + 1;
+        }
+
+        // Transforms `size` real samples and returns the first half of the
+        // spectrum. The returned pointer stays valid until the next call.
+        const std::complex<float>* execute(const float* samples);
+
+        // The same for the samples multiplied by `window`, which is done
+        // while they are packed
+        const std::complex<float>* execute(const float* samples, const float* window);
+
+        // Magnitudes of `count` bins of the last spectrum computed, starting
+        // at `first_bin`. Same lifetime as the spectrum.
+        const float* get_magnitudes(size_t first_bin, size_t count);
+    };
+
+    // The spectrum of `size` real samples at `count` evenly spaced points,
+    // X[first_point + m] of a `grid_size` point DFT of the zero-padded input,
+    // by the chirp-z transform. With grid_size a multiple of size this zooms
+    // into a band at a finer spacing than the FFT bins.
+    class chirp_z_plan {
+    private:
+        size_t size, grid_size, first_point, count;
+        std::unique_ptr<fft_plan> convolution_plan;
+        std::vector<std::complex<float>> input_chirp, output_chirp, chirp_spectrum;
+        std::vector<std::complex<float>> points;
+        std::vector<float> magnitudes;
+
+    public:
+        chirp_z_plan(size_t _size, size_t _grid_size, size_t _first_point, size_t _count);
+
+        size_t get_convolution_size() const {
+            return convolution_plan->get_size();
+        }
+
+        // Returns the `count` points for `size` real samples. The returned
+        // pointer stays valid until the next call.
+        const std::complex<float>* execute(const float* samples);
+
+        // Magnitudes of all points of the last call
+        const float* get_magnitudes();
+    };
+
+    // Real transforms of up to `batch_size` frames at a time. The frames are
+    // transposed into a structure-of-arrays layout, interleaved by frame, so
+    // that each butterfly's twiddle is loaded once for the whole batch and
+    // vector lanes work across frames. Sizes whose packed transform is not a
+    // power of two are transformed frame by frame instead, with the same
+    // results.
+    class fft_batch_plan {
+    private:
+        size_t size, batch_size, frame_count;
+        bool batched;
+        const fft_kernels_t* kernels;
+        real_fft_plan frame_plan;
+
+        std::vector<size_t> bit_reversal;
+        std::vector<std::complex<float>> twiddles, unpack_twiddles;
+
+        // Value i of frame f is at i * frame_count + f in all of these
+        std::vector<float> re, im;
+        std::vector<float> spectrum_re, spectrum_im;
+        std::vector<float> magnitudes;
+        std::vector<float> sums;
+
+        void transform();
+        void unpack(size_t first_bin, size_t count);
+
+    public:
+        fft_batch_plan(size_t _size, size_t _batch_size);
+
+        size_t get_size() const {
+            return size;
+        }
+
+        size_t get_batch_size() const {
+            return batch_size;
+        }
+
+        size_t get_bin_count() const {
+            return size / 2 + 1;
+        }
+
+        // Transforms `count` frames of `size` real samples, stored one after
+        // the other
+        void execute(const float* frames, size_t count);
+
+        // Transforms `count` frames of `size` real samples each, anywhere in
+        // memory, multiplied by `window`. The window is applied in the same
+        // pass that packs and transposes the frames into the batch.
+        void execute(const float* const* frames, size_t count, const float* window);
+
+        // One float per frame, for callers to accumulate into
+        float* get_scratch() {
+            return &sums[0];
+        }
+
+        // Magnitudes of `count` bins of every frame of the last batch,
+        // starting at `first_bin`. Bin k of frame f is at
+        // (k - first_bin) * frames + f. Valid until the next call.
+        const float* get_magnitudes(size_t first_bin, size_t count);
+    };
+
+    size_t get_bucket_count(size_t step_hertz, size_t min_hertz, size_t max_hertz);
+
+    // Which bins make up each histogram bucket, worked out once for a
+    // transform size and frequency range. Bucket b adds up
+    // weights[e] * magnitude[bins[e]] for offsets[b] <= e < offsets[b + 1],
+    // with bins counted from get_first_bin().
+    class bucket_table {
+    private:
+        size_t bucket_count;
+        int first_bin, end_bin;
+        std::vector<size_t> offsets;
+        std::vector<int> bins;
+        std::vector<float> weights;
+
+    public:
+        // Buckets every step_hertz from min_hertz to max_hertz, over the bins
+        // of a `samples` point transform up to last_bin
+        bucket_table(size_t sample_rate,
+                     size_t samples,
+                     size_t step_hertz,
+                     size_t min_hertz,
+                     size_t max_hertz,
+                     int last_bin);
+
+        size_t get_bucket_count() const {
+            return bucket_count;
+        }
+
+        // The range of bins touched by any bucket; empty if the whole
+        // frequency range is above Nyquist
+        int get_first_bin() const {
+            return first_bin;
+        }
+
+        int get_end_bin() const {
+            return end_bin;
+        }
+
+        size_t get_bin_count() const {
+            return end_bin - first_bin + 1;
+        }
+
+        // magnitudes[i] is the magnitude of bin get_first_bin() + i
+        void reduce(const float* magnitudes, float factor, float* destination) const;
+
+        // The same for a batch laid out as by fft_batch_plan::get_magnitudes,
+        // with bucket b of frame f going to destination[f * buckets + b].
+        // `sums` holds frame_count floats of scratch space.
+        void reduce_batch(const float* magnitudes,
+                          size_t frame_count,
+                          float factor,
+                          float* sums,
+                          float* destination) const;
+    };
+
+    fft_result_t fft_from_samples(real_fft_plan& plan,
+                                  const bucket_table& buckets,
+                                  const std::vector<float>& samples,
                                   float window_normalization_factor = 1.0f);
 
+    // Same as fft_from_samples, for `frame_count` frames stored one after the
+    // other. The buckets of all frames are written to `destination`, frame
+    // after frame.
+    void fft_from_samples_batch(fft_batch_plan& plan,
+                                const bucket_table& buckets,
+                                const float* frames,
+                                size_t frame_count,
+                                float window_normalization_factor,
+                                float* destination);
 
+    // The same for frames anywhere in memory, multiplied by `window` on the
+    // way into the transform
+    void fft_from_samples_batch(fft_batch_plan& plan,
+                                const bucket_table& buckets,
+                                const float* const* frames,
+                                size_t frame_count,
+                                const float* window,
+                                float window_normalization_factor,
+                                float* destination);
 }
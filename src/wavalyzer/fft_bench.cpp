@@ -0,0 +1,104 @@
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <chrono>
+#include <cstdlib>
+#include <cmath>
+#include "fft.hpp"
+
+// Compares per-frame and batched analysis throughput with the same bucket
+// settings as wavalyzer's defaults.
+
+using namespace std;
+
+const size_t SAMPLE_RATE = 44100;
+const size_t MIN_FREQ = 100;
+const size_t MAX_FREQ = 2000;
+const size_t FREQ_STEP = 10;
+const size_t TOTAL_FRAMES = 4096;
+const size_t BATCH_SIZES[] = { 8, 32, 128 };
+const int REPETITIONS = 5;
+
+double seconds_since(chrono::steady_clock::time_point start)
+{
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+double time_per_frame(const vector<float>& frames, size_t window_size)
+{
+    wavalyzer::real_fft_plan plan(window_size);
+    wavalyzer::bucket_table buckets(SAMPLE_RATE, window_size, FREQ_STEP, MIN_FREQ, MAX_FREQ,
+                                    static_cast<int>(window_size / 2));
+    vector<float> window_samples(window_size);
+    double best = INFINITY;
+
+    for (int r = 0; r < REPETITIONS; r++) {
+        auto start = chrono::steady_clock::now();
+        for (size_t f = 0; f < TOTAL_FRAMES; f++) {
+            copy(frames.begin() + f * window_size, frames.begin() + (f + 1) * window_size,
+                 window_samples.begin());
+
+            wavalyzer::fft_from_samples(plan, buckets, window_samples);
+        }
+
+        best = min(best, seconds_since(start));
+    }
+
+    return best;
+}
+
+double time_batched(const vector<float>& frames, size_t window_size, size_t batch_size)
+{
+    wavalyzer::fft_batch_plan plan(window_size, batch_size);
+    wavalyzer::bucket_table buckets(SAMPLE_RATE, window_size, FREQ_STEP, MIN_FREQ, MAX_FREQ,
+                                    static_cast<int>(window_size / 2));
+    vector<float> results(buckets.get_bucket_count() * batch_size);
+    double best = INFINITY;
+
+    for (int r = 0; r < REPETITIONS; r++) {
+        auto start = chrono::steady_clock::now();
+        for (size_t f = 0; f < TOTAL_FRAMES; f += batch_size) {
+            size_t count = min(batch_size, TOTAL_FRAMES - f);
+            wavalyzer::fft_from_samples_batch(plan, buckets, &frames[f * window_size], count,
+                                              1.0f, &results[0]);
+        }
+
+        best = min(best, seconds_since(start));
+    }
+
+    return best;
+}
+
+int main(int argc, char* argv[])
+{
+    size_t window_size = argc > 1 ? atoi(argv[1]) : 1024;
+    if (argc > 2) {
+        wavalyzer::select_fft_kernels(argv[2]);
+    }
+
+    if (window_size < 2) {
+        cerr << "Usage: " << argv[0] << " [window size] [kernel]" << endl;
+        return -1;
+    }
+
+    vector<float> frames(window_size * TOTAL_FRAMES);
+    for (float& f : frames) {
+        f = 2.0f * rand() / RAND_MAX - 1.0f;
+    }
+
+    cout << "[+] " << TOTAL_FRAMES << " frames of " << window_size << " samples, "
+         << wavalyzer::get_fft_kernels().name << " kernels" << endl;
+
+    double single = time_per_frame(frames, window_size);
+    cout << fixed << setprecision(0) <<
+            "[|] Per-frame:  " << TOTAL_FRAMES / single << " frames/s" << endl;
+
+    for (size_t batch_size : BATCH_SIZES) {
+        double batched = time_batched(frames, window_size, batch_size);
+        cout << fixed << setprecision(0) <<
+                "[|] K = " << setw(3) << batch_size << ":    " << TOTAL_FRAMES / batched << " frames/s (" <<
+                setprecision(2) << single / batched << "x)" << endl;
+    }
+
+    return 0;
+}
@@ -0,0 +1,111 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+// Bit-reversal and twiddle tables for the power-of-two complex transforms
+// with a compile-time size, generated by the compiler. They only hold data,
+// so it does not matter which instruction set the including translation
+// unit is built for, and every copy of them is the same.
+namespace wavalyzer {
+    // Complex transform sizes with their own instantiations, 64 to 8192,
+    // which are the packed halves of real windows of 128 to 16384 samples
+    const size_t FIXED_FFT_MIN_LOG2 = 6;
+    const size_t FIXED_FFT_MAX_LOG2 = 13;
+    const size_t FIXED_FFT_SIZE_COUNT = FIXED_FFT_MAX_LOG2 - FIXED_FFT_MIN_LOG2 + 1;
+
+    constexpr size_t fixed_fft_log2(size_t size)
+    {
+        return size <= 1 ? 0 : 1 + fixed_fft_log2(size / 2);
+    }
+
+    // sin(x) and cos(x) by their Taylor series, for 0 <= x <= pi / 4
+    constexpr void fixed_fft_sin_cos(double x, double& sine, double& cosine)
+    {
+        double x2 = x * x, sin_term = x, cos_term = 1.0;
+        sine = 0.0;
+        cosine = 0.0;
+
+        for (int n = 1; n <= 20; n++) {
+            sine += sin_term;
+            cosine += cos_term;
+            sin_term *= -x2 / ((2 * n) * (2 * n + 1));
+            cos_term *= -x2 / ((2 * n - 1) * (2 * n));
+        }
+    }
+
+    // exp(-pi i j / half) for 0 <= j < half. The angle is folded into the
+    // first octant with integer arithmetic, where the series converges fast
+    // and nothing is lost to rounding pi j / half first.
+    constexpr void fixed_fft_twiddle(size_t j, size_t half, double& re, double& im)
+    {
+        const double PI = 3.14159265358979323846;
+
+        // The angle in units of pi / (4 half), within [0, 4 half)
+        size_t units = 4 * j;
+        bool negate_cos = false, swap = false;
+
+        if (units > 2 * half) {
+            // cos(pi - x) = -cos x, sin(pi - x) = sin x
+            units = 4 * half - units;
+            negate_cos = true;
+        }
+
+        if (units > half) {
+            // cos(pi / 2 - x) = sin x
+            units = 2 * half - units;
+            swap = true;
+        }
+
+        double sine = 0.0, cosine = 0.0;
+        fixed_fft_sin_cos(PI * units / (4.0 * half), sine, cosine);
+
+        if (swap) {
+            double t = sine;
+            sine = cosine;
+            cosine = t;
+        }
+
+        re = negate_cos ? -cosine : cosine;
+        im = -sine;
+    }
+
+    // Same layouts as compute_bit_reversal and compute_stage_twiddles
+    template<size_t Size>
+    struct fixed_fft_tables_t {
+        std::uint16_t bit_reversal[Size];
+        float twiddles[2 * (Size - 1)];
+
+        constexpr fixed_fft_tables_t() : bit_reversal(), twiddles()
+        {
+            const size_t bits = fixed_fft_log2(Size);
+
+            for (size_t i = 0; i < Size; i++) {
+                size_t reversed = 0;
+                for (size_t b = 0; b < bits; b++) {
+                    if (i & (static_cast<size_t>(1) << b)) {
+                        reversed |= static_cast<size_t>(1) << (bits - 1 - b);
+                    }
+                }
+
+                bit_reversal[i] = static_cast<std::uint16_t>(reversed);
+            }
+
+            for (size_t half = 1; half < Size; half *= 2) {
+                for (size_t j = 0; j < half; j++) {
+                    double re = 0.0, im = 0.0;
+                    fixed_fft_twiddle(j, half, re, im);
+                    twiddles[2 * (half - 1 + j)] = static_cast<float>(re);
+                    twiddles[2 * (half - 1 + j) + 1] = static_cast<float>(im);
+                }
+            }
+        }
+    };
+
+    template<size_t Size>
+    struct fixed_fft_tables {
+        static constexpr fixed_fft_tables_t<Size> VALUE = fixed_fft_tables_t<Size>();
+    };
+
+    template<size_t Size>
+    constexpr fixed_fft_tables_t<Size> fixed_fft_tables<Size>::VALUE;
+}
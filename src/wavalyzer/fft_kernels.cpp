@@ -0,0 +1,103 @@
+#include "fft_kernels.hpp"
+#include "fft.hpp"
+
+using namespace wavalyzer;
+using namespace std;
+
+namespace wavalyzer {
+    struct fft_kernel_entry_t {
+        const fft_kernels_t* kernels;
+        bool (*supported)();
+    };
+
+    bool cpu_always_supported()
+    {
+        return true;
+    }
+
+#ifdef WAVALYZER_X86_KERNELS
+    bool cpu_supports_sse2()
+    {
+        return __builtin_cpu_supports("sse2");
+    }
+
+    bool cpu_supports_avx2()
+    {
+        return __builtin_cpu_supports("avx2");
+    }
+
+    bool cpu_supports_avx512()
+    {
+        return __builtin_cpu_supports("avx512f");
+    }
+#endif
+
+    // Ordered from slowest to fastest
+    const fft_kernel_entry_t FFT_KERNEL_TABLE[] = {
+        { &FFT_KERNELS_SCALAR, cpu_always_supported },
+#ifdef WAVALYZER_X86_KERNELS
+        { &FFT_KERNELS_SSE2, cpu_supports_sse2 },
+        { &FFT_KERNELS_AVX2, cpu_supports_avx2 },
+        { &FFT_KERNELS_AVX512, cpu_supports_avx512 },
+#endif
+    };
+
+    const size_t FFT_KERNEL_COUNT = sizeof(FFT_KERNEL_TABLE) / sizeof(FFT_KERNEL_TABLE[0]);
+
+    const fft_kernels_t* detect_fft_kernels()
+    {
+#ifdef WAVALYZER_X86_KERNELS
+        // Detection runs during static initialization, possibly before
+        // libgcc has probed the CPU itself
+        __builtin_cpu_init();
+#endif
+
+        for (size_t i = FFT_KERNEL_COUNT; i > 0; i--) {
+            if (FFT_KERNEL_TABLE[i - 1].supported()) {
+                return FFT_KERNEL_TABLE[i - 1].kernels;
+            }
+        }
+
+        return &FFT_KERNELS_SCALAR;
+    }
+
+    const fft_kernels_t* active_fft_kernels = detect_fft_kernels();
+}
+
+vector<string> wavalyzer::get_fft_kernel_names()
+{
+    vector<string> names;
+    for (const fft_kernel_entry_t& entry : FFT_KERNEL_TABLE) {
+        names.push_back(entry.kernels->name);
+    }
+
+    return names;
+}
+
+const fft_kernels_t& wavalyzer::get_fft_kernels()
+{
+    return *active_fft_kernels;
+}
+
+void wavalyzer::select_fft_kernels(const string& name)
+{
+    if (name == "auto") {
+        active_fft_kernels = detect_fft_kernels();
+        return;
+    }
+
+    for (const fft_kernel_entry_t& entry : FFT_KERNEL_TABLE) {
+        if (name != entry.kernels->name) {
+            continue;
+        }
+
+        if (!entry.supported()) {
+            throw fft_exception("This CPU cannot run the " + name + " FFT kernels");
+        }
+
+        active_fft_kernels = entry.kernels;
+        return;
+    }
+
+    throw fft_exception("Unknown FFT kernel `" + name + "`");
+}
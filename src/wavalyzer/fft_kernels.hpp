@@ -0,0 +1,108 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "fft_fixed.hpp"
+
+namespace wavalyzer {
+    // The inner loops of the FFT, built once per instruction set. Complex
+    // values are passed as interleaved (re, im) floats so that the kernel
+    // translation units never instantiate anything from the standard
+    // library with wider instructions than the rest of the program.
+    struct fft_kernels_t {
+        const char* name;
+
+        // One radix-2 pass combining transforms of length `half` into ones
+        // of length 2 * half, using that stage's `half` contiguous twiddles
+        void (*radix2_pass)(float* data,
+                            size_t size,
+                            size_t half,
+                            const float* twiddles);
+
+        // Two radix-2 passes (`half` and 2 * half) fused into one radix-4
+        // pass over the data
+        void (*radix4_pass)(float* data,
+                            size_t size,
+                            size_t half,
+                            const float* twiddles,
+                            const float* next_twiddles);
+
+        void (*magnitudes)(const float* data, size_t count, float* destination);
+
+        // Whole in-place transforms of 2^(FIXED_FFT_MIN_LOG2 + i) values,
+        // with their sizes, stages and tables fixed at compile time
+        void (*fixed_fft[FIXED_FFT_SIZE_COUNT])(float* data);
+
+        // Radix-2 pass over `batch` transforms at once. Their real and
+        // imaginary parts are kept in separate arrays, interleaved by frame
+        // (value i of frame f lives at i * batch + f), so vector lanes run
+        // across frames and every twiddle is loaded once for all of them.
+        void (*batch_radix2_pass)(float* re,
+                                  float* im,
+                                  size_t size,
+                                  size_t batch,
+                                  size_t half,
+                                  const float* twiddles);
+
+        // radix4_pass over a batch, laid out as for batch_radix2_pass
+        void (*batch_radix4_pass)(float* re,
+                                  float* im,
+                                  size_t size,
+                                  size_t batch,
+                                  size_t half,
+                                  const float* twiddles,
+                                  const float* next_twiddles);
+
+        // Like magnitudes, but with separate real and imaginary arrays
+        void (*split_magnitudes)(const float* re,
+                                 const float* im,
+                                 size_t count,
+                                 float* destination);
+
+        // Multiplies `2 * half` real samples by `window` and packs them
+        // pairwise into frame `frame` of a batch laid out as for
+        // batch_radix2_pass, pair j going to position reversal[j]
+        void (*batch_window_pack)(const float* samples,
+                                  const float* window,
+                                  size_t half,
+                                  const size_t* reversal,
+                                  size_t batch,
+                                  size_t frame,
+                                  float* re,
+                                  float* im);
+
+        // 20 log10 of `count` bucket levels, to within 1e-4 dB, with
+        // silence clamped to the smallest normal float (about -759 dB)
+        void (*levels_to_db)(const float* levels, size_t count, float* destination);
+
+        // `count` little-endian PCM samples to floats in [-1, 1]: unsigned
+        // 8-bit, signed 16-, 24- and 32-bit, and 64-bit floats. The signed
+        // ones are divided by 2^(bits - 1) if negative and by
+        // 2^(bits - 1) - 1 otherwise.
+        void (*decode_u8)(const std::uint8_t* source, size_t count, float* destination);
+        void (*decode_s16)(const std::uint8_t* source, size_t count, float* destination);
+        void (*decode_s24)(const std::uint8_t* source, size_t count, float* destination);
+        void (*decode_s32)(const std::uint8_t* source, size_t count, float* destination);
+        void (*decode_f64)(const std::uint8_t* source, size_t count, float* destination);
+    };
+
+    extern const fft_kernels_t FFT_KERNELS_SCALAR;
+#ifdef WAVALYZER_X86_KERNELS
+    extern const fft_kernels_t FFT_KERNELS_SSE2;
+    extern const fft_kernels_t FFT_KERNELS_AVX2;
+    extern const fft_kernels_t FFT_KERNELS_AVX512;
+#endif
+
+    // Names of all kernels built into this binary, from slowest to fastest
+    std::vector<std::string> get_fft_kernel_names();
+
+    // The kernels FFT plans are built with. Unless overridden, this is the
+    // fastest set the CPU supports.
+    const fft_kernels_t& get_fft_kernels();
+
+    // Forces a specific kernel set ("auto" restores detection). Throws an
+    // fft_exception if the name is unknown or the CPU cannot run it. Only
+    // plans built after this call are affected.
+    void select_fft_kernels(const std::string& name);
+}
@@ -0,0 +1,29 @@
+#include "fft_kernels.hpp"
+#include "fft_kernels_avx2.hpp"
+
+const wavalyzer::fft_kernels_t wavalyzer::FFT_KERNELS_AVX2 = {
+    "avx2",
+    radix2_pass<avx2_ops>,
+    radix4_pass<avx2_ops>,
+    magnitudes<avx2_ops>,
+    {
+        fixed_fft<avx2_ops, 64>,
+        fixed_fft<avx2_ops, 128>,
+        fixed_fft<avx2_ops, 256>,
+        fixed_fft<avx2_ops, 512>,
+        fixed_fft<avx2_ops, 1024>,
+        fixed_fft<avx2_ops, 2048>,
+        fixed_fft<avx2_ops, 4096>,
+        fixed_fft<avx2_ops, 8192>
+    },
+    batch_radix2_pass<avx2_ops>,
+    batch_radix4_pass<avx2_ops>,
+    split_magnitudes<avx2_ops>,
+    batch_window_pack<avx2_ops>,
+    levels_to_db<avx2_ops>,
+    decode_pcm<avx2_ops, pcm_u8>,
+    decode_pcm<avx2_ops, pcm_s16>,
+    decode_pcm<avx2_ops, pcm_s24>,
+    decode_pcm<avx2_ops, pcm_s32>,
+    decode_pcm<avx2_ops, pcm_f64>
+};
@@ -0,0 +1,167 @@
+#pragma once
+#include "fft_kernels_sse2.hpp"
+#include <immintrin.h>
+
+// Vector operations on 256-bit AVX2 registers; see fft_kernels_impl.hpp.
+namespace {
+    struct avx2_ops {
+        // Used for whatever is too short for a full vector
+        typedef sse2_ops half_ops;
+
+        static const size_t WIDTH = 4;
+        static const size_t MAGNITUDE_WIDTH = 8;
+
+        typedef __m256 vec;
+
+        static inline vec load(const float* p)
+        {
+            return _mm256_loadu_ps(p);
+        }
+
+        static inline void store(float* p, vec v)
+        {
+            _mm256_storeu_ps(p, v);
+        }
+
+        static inline vec add(vec a, vec b)
+        {
+            return _mm256_add_ps(a, b);
+        }
+
+        static inline vec sub(vec a, vec b)
+        {
+            return _mm256_sub_ps(a, b);
+        }
+
+        static inline vec mul(vec a, vec b)
+        {
+            // Deliberately not fmaddsub, to round exactly like the other tiers
+            vec b_re = _mm256_moveldup_ps(b),
+                b_im = _mm256_movehdup_ps(b),
+                a_swapped = _mm256_permute_ps(a, _MM_SHUFFLE(2, 3, 0, 1));
+
+            return _mm256_addsub_ps(_mm256_mul_ps(a, b_re), _mm256_mul_ps(a_swapped, b_im));
+        }
+
+        static inline void magnitudes(const float* src, float* dst)
+        {
+            vec lo = _mm256_loadu_ps(src),
+                hi = _mm256_loadu_ps(src + 8);
+
+            lo = _mm256_mul_ps(lo, lo);
+            hi = _mm256_mul_ps(hi, hi);
+
+            // hadd works within 128-bit lanes, leaving the sums ordered as
+            // 0 1 4 5 | 2 3 6 7, so the middle 64-bit quarters are swapped back
+            vec sums = _mm256_hadd_ps(lo, hi);
+            sums = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(sums), _MM_SHUFFLE(3, 1, 2, 0)));
+
+            _mm256_storeu_ps(dst, _mm256_sqrt_ps(sums));
+        }
+
+        static const size_t FLOAT_WIDTH = 8;
+
+        typedef __m256 fvec;
+
+        static inline fvec fload(const float* p)
+        {
+            return _mm256_loadu_ps(p);
+        }
+
+        static inline void fstore(float* p, fvec v)
+        {
+            _mm256_storeu_ps(p, v);
+        }
+
+        static inline fvec fset(float f)
+        {
+            return _mm256_set1_ps(f);
+        }
+
+        static inline fvec fadd(fvec a, fvec b)
+        {
+            return _mm256_add_ps(a, b);
+        }
+
+        static inline fvec fsub(fvec a, fvec b)
+        {
+            return _mm256_sub_ps(a, b);
+        }
+
+        static inline fvec fmul(fvec a, fvec b)
+        {
+            return _mm256_mul_ps(a, b);
+        }
+
+        static inline fvec fdiv(fvec a, fvec b)
+        {
+            return _mm256_div_ps(a, b);
+        }
+
+        static inline fvec fmax(fvec a, fvec b)
+        {
+            return _mm256_max_ps(a, b);
+        }
+
+        static inline fvec fsqrt(fvec a)
+        {
+            return _mm256_sqrt_ps(a);
+        }
+
+        static inline fvec fsplit(fvec x, fvec& exponent)
+        {
+            __m256i bits = _mm256_castps_si256(x);
+
+            exponent = _mm256_cvtepi32_ps(_mm256_sub_epi32(_mm256_srli_epi32(bits, 23),
+                                                           _mm256_set1_epi32(127)));
+            return _mm256_castsi256_ps(_mm256_or_si256(_mm256_and_si256(bits, _mm256_set1_epi32(0x7fffff)),
+                                                       _mm256_set1_epi32(0x3f800000)));
+        }
+
+        static inline fvec fselect_less(fvec a, fvec b, fvec x, fvec y)
+        {
+            return _mm256_blendv_ps(y, x, _mm256_cmp_ps(a, b, _CMP_LT_OQ));
+        }
+
+        static inline fvec fload_u8(const uint8_t* p)
+        {
+            __m128i bytes = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(p));
+            return _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(bytes));
+        }
+
+        static inline fvec fload_s16(const uint8_t* p)
+        {
+            __m128i words = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+            return _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(words));
+        }
+
+        static inline fvec fload_s24(const uint8_t* p)
+        {
+            // Two loads that end exactly at the last sample, so nothing past
+            // it is read. Every sample is shuffled into the top three bytes
+            // of its lane, then shifted down to sign-extend.
+            const __m128i low_order = _mm_setr_epi8(-1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11),
+                          high_order = _mm_setr_epi8(-1, 4, 5, 6, -1, 7, 8, 9, -1, 10, 11, 12, -1, 13, 14, 15);
+
+            __m128i low = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p)), low_order),
+                    high = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 8)), high_order);
+
+            __m256i samples = _mm256_inserti128_si256(_mm256_castsi128_si256(low), high, 1);
+            return _mm256_cvtepi32_ps(_mm256_srai_epi32(samples, 8));
+        }
+
+        static inline fvec fload_s32(const uint8_t* p)
+        {
+            return _mm256_cvtepi32_ps(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)));
+        }
+
+        static inline fvec fload_f64(const uint8_t* p)
+        {
+            const double* samples = reinterpret_cast<const double*>(p);
+            __m128 low = _mm256_cvtpd_ps(_mm256_loadu_pd(samples)),
+                   high = _mm256_cvtpd_ps(_mm256_loadu_pd(samples + 4));
+
+            return _mm256_insertf128_ps(_mm256_castps128_ps256(low), high, 1);
+        }
+    };
+}
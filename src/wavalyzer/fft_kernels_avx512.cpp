@@ -0,0 +1,194 @@
+#include "fft_kernels.hpp"
+#include "fft_kernels_avx2.hpp"
+#include <immintrin.h>
+
+namespace {
+    struct avx512_ops {
+        // Used for whatever is too short for a full vector
+        typedef avx2_ops half_ops;
+
+        static const size_t WIDTH = 8;
+        static const size_t MAGNITUDE_WIDTH = 16;
+
+        typedef __m512 vec;
+
+        static inline vec load(const float* p)
+        {
+            return _mm512_loadu_ps(p);
+        }
+
+        static inline void store(float* p, vec v)
+        {
+            _mm512_storeu_ps(p, v);
+        }
+
+        static inline vec add(vec a, vec b)
+        {
+            return _mm512_add_ps(a, b);
+        }
+
+        static inline vec sub(vec a, vec b)
+        {
+            return _mm512_sub_ps(a, b);
+        }
+
+        static inline vec mul(vec a, vec b)
+        {
+            // There is no unfused addsub at this width; subtract in the
+            // real (even) lanes and add in the imaginary ones instead
+            vec b_re = _mm512_moveldup_ps(b),
+                b_im = _mm512_movehdup_ps(b),
+                a_swapped = _mm512_permute_ps(a, _MM_SHUFFLE(2, 3, 0, 1));
+
+            vec p = _mm512_mul_ps(a, b_re),
+                q = _mm512_mul_ps(a_swapped, b_im);
+
+            return _mm512_mask_sub_ps(_mm512_add_ps(p, q), 0x5555, p, q);
+        }
+
+        static inline void magnitudes(const float* src, float* dst)
+        {
+            const __m512i even_lanes = _mm512_set_epi32(30, 28, 26, 24, 22, 20, 18, 16,
+                                                        14, 12, 10, 8, 6, 4, 2, 0);
+            const __m512i odd_lanes = _mm512_set_epi32(31, 29, 27, 25, 23, 21, 19, 17,
+                                                       15, 13, 11, 9, 7, 5, 3, 1);
+
+            vec lo = _mm512_loadu_ps(src),
+                hi = _mm512_loadu_ps(src + 16);
+
+            lo = _mm512_mul_ps(lo, lo);
+            hi = _mm512_mul_ps(hi, hi);
+
+            vec re = _mm512_permutex2var_ps(lo, even_lanes, hi),
+                im = _mm512_permutex2var_ps(lo, odd_lanes, hi);
+
+            _mm512_storeu_ps(dst, _mm512_sqrt_ps(_mm512_add_ps(re, im)));
+        }
+
+        static const size_t FLOAT_WIDTH = 16;
+
+        typedef __m512 fvec;
+
+        static inline fvec fload(const float* p)
+        {
+            return _mm512_loadu_ps(p);
+        }
+
+        static inline void fstore(float* p, fvec v)
+        {
+            _mm512_storeu_ps(p, v);
+        }
+
+        static inline fvec fset(float f)
+        {
+            return _mm512_set1_ps(f);
+        }
+
+        static inline fvec fadd(fvec a, fvec b)
+        {
+            return _mm512_add_ps(a, b);
+        }
+
+        static inline fvec fsub(fvec a, fvec b)
+        {
+            return _mm512_sub_ps(a, b);
+        }
+
+        static inline fvec fmul(fvec a, fvec b)
+        {
+            return _mm512_mul_ps(a, b);
+        }
+
+        static inline fvec fdiv(fvec a, fvec b)
+        {
+            return _mm512_div_ps(a, b);
+        }
+
+        static inline fvec fmax(fvec a, fvec b)
+        {
+            return _mm512_max_ps(a, b);
+        }
+
+        static inline fvec fsqrt(fvec a)
+        {
+            return _mm512_sqrt_ps(a);
+        }
+
+        static inline fvec fsplit(fvec x, fvec& exponent)
+        {
+            __m512i bits = _mm512_castps_si512(x);
+
+            exponent = _mm512_cvtepi32_ps(_mm512_sub_epi32(_mm512_srli_epi32(bits, 23),
+                                                           _mm512_set1_epi32(127)));
+            return _mm512_castsi512_ps(_mm512_or_si512(_mm512_and_si512(bits, _mm512_set1_epi32(0x7fffff)),
+                                                       _mm512_set1_epi32(0x3f800000)));
+        }
+
+        static inline fvec fselect_less(fvec a, fvec b, fvec x, fvec y)
+        {
+            return _mm512_mask_blend_ps(_mm512_cmp_ps_mask(a, b, _CMP_LT_OQ), y, x);
+        }
+
+        static inline fvec fload_u8(const uint8_t* p)
+        {
+            __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+            return _mm512_cvtepi32_ps(_mm512_cvtepu8_epi32(bytes));
+        }
+
+        static inline fvec fload_s16(const uint8_t* p)
+        {
+            __m256i words = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+            return _mm512_cvtepi32_ps(_mm512_cvtepi16_epi32(words));
+        }
+
+        static inline fvec fload_s24(const uint8_t* p)
+        {
+            return combine(avx2_ops::fload_s24(p), avx2_ops::fload_s24(p + 24));
+        }
+
+        static inline fvec fload_s32(const uint8_t* p)
+        {
+            return _mm512_cvtepi32_ps(_mm512_loadu_si512(p));
+        }
+
+        static inline fvec fload_f64(const uint8_t* p)
+        {
+            const double* samples = reinterpret_cast<const double*>(p);
+            return combine(_mm512_cvtpd_ps(_mm512_loadu_pd(samples)), _mm512_cvtpd_ps(_mm512_loadu_pd(samples + 8)));
+        }
+
+        // Two halves into one register, without AVX-512DQ
+        static inline fvec combine(__m256 low, __m256 high)
+        {
+            return _mm512_castpd_ps(_mm512_insertf64x4(_mm512_castps_pd(_mm512_castps256_ps512(low)),
+                                                       _mm256_castps_pd(high), 1));
+        }
+    };
+}
+
+const wavalyzer::fft_kernels_t wavalyzer::FFT_KERNELS_AVX512 = {
+    "avx512",
+    radix2_pass<avx512_ops>,
+    radix4_pass<avx512_ops>,
+    magnitudes<avx512_ops>,
+    {
+        fixed_fft<avx512_ops, 64>,
+        fixed_fft<avx512_ops, 128>,
+        fixed_fft<avx512_ops, 256>,
+        fixed_fft<avx512_ops, 512>,
+        fixed_fft<avx512_ops, 1024>,
+        fixed_fft<avx512_ops, 2048>,
+        fixed_fft<avx512_ops, 4096>,
+        fixed_fft<avx512_ops, 8192>
+    },
+    batch_radix2_pass<avx512_ops>,
+    batch_radix4_pass<avx512_ops>,
+    split_magnitudes<avx512_ops>,
+    batch_window_pack<avx512_ops>,
+    levels_to_db<avx512_ops>,
+    decode_pcm<avx512_ops, pcm_u8>,
+    decode_pcm<avx512_ops, pcm_s16>,
+    decode_pcm<avx512_ops, pcm_s24>,
+    decode_pcm<avx512_ops, pcm_s32>,
+    decode_pcm<avx512_ops, pcm_f64>
+};
@@ -0,0 +1,619 @@
+#pragma once
+#include <cstddef>
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+#include "fft_fixed.hpp"
+
+// Shared body of the fft_kernels_*.cpp translation units, each of which
+// instantiates it with the vector operations of one instruction set.
+// Everything in here has internal linkage, so no out-of-line copy compiled
+// for a wider instruction set can be picked up by the rest of the program.
+//
+// The kernels are compiled with -ffp-contract=off and do their arithmetic
+// in the same order as the scalar ones, so every tier produces bit-identical
+// results.
+//
+// A vector-ops type provides:
+//   half_ops              the ops to fall back to for anything too short
+//                         for a full vector
+//   WIDTH                 complex values per vector
+//   vec                   the vector type
+//   load / store          unaligned access to WIDTH interleaved complex values
+//   add / sub / mul       element-wise complex arithmetic
+//   MAGNITUDE_WIDTH       complex values consumed per magnitudes() call
+//   magnitudes(src, dst)  |z| of MAGNITUDE_WIDTH interleaved complex values
+//   FLOAT_WIDTH           floats per fvec
+//   fvec                  a vector of plain floats
+//   fload / fstore / fset / fadd / fsub / fmul / fdiv / fmax / fsqrt
+//                         unaligned access, broadcast and arithmetic on fvec;
+//                         fmax(a, b) gives b where a is NaN
+//   fsplit(x, exponent)   the mantissa of positive normal floats, in [1, 2),
+//                         with their unbiased exponents as floats
+//   fselect_less(a, b, x, y)
+//                         x where a < b, y elsewhere
+//   fload_u8 / fload_s16 / fload_s24 / fload_s32 / fload_f64
+//                         FLOAT_WIDTH unaligned little-endian samples of
+//                         that type, converted to float as they are
+namespace {
+    struct scalar_ops {
+        typedef scalar_ops half_ops;
+
+        static const size_t WIDTH = 1;
+        static const size_t MAGNITUDE_WIDTH = 1;
+
+        struct vec {
+            float re, im;
+        };
+
+        static inline vec load(const float* p)
+        {
+            vec v = { p[0], p[1] };
+            return v;
+        }
+
+        static inline void store(float* p, vec v)
+        {
+            p[0] = v.re;
+            p[1] = v.im;
+        }
+
+        static inline vec add(vec a, vec b)
+        {
+            vec v = { a.re + b.re, a.im + b.im };
+            return v;
+        }
+
+        static inline vec sub(vec a, vec b)
+        {
+            vec v = { a.re - b.re, a.im - b.im };
+            return v;
+        }
+
+        static inline vec mul(vec a, vec b)
+        {
+            vec v = { a.re * b.re - a.im * b.im, a.im * b.re + a.re * b.im };
+            return v;
+        }
+
+        static inline void magnitudes(const float* src, float* dst)
+        {
+            dst[0] = sqrtf(src[0] * src[0] + src[1] * src[1]);
+        }
+
+        static const size_t FLOAT_WIDTH = 1;
+
+        typedef float fvec;
+
+        static inline fvec fload(const float* p)
+        {
+            return *p;
+        }
+
+        static inline void fstore(float* p, fvec v)
+        {
+            *p = v;
+        }
+
+        static inline fvec fset(float f)
+        {
+            return f;
+        }
+
+        static inline fvec fadd(fvec a, fvec b)
+        {
+            return a + b;
+        }
+
+        static inline fvec fsub(fvec a, fvec b)
+        {
+            return a - b;
+        }
+
+        static inline fvec fmul(fvec a, fvec b)
+        {
+            return a * b;
+        }
+
+        static inline fvec fdiv(fvec a, fvec b)
+        {
+            return a / b;
+        }
+
+        static inline fvec fmax(fvec a, fvec b)
+        {
+            return a > b ? a : b;
+        }
+
+        static inline fvec fsqrt(fvec a)
+        {
+            return sqrtf(a);
+        }
+
+        static inline fvec fsplit(fvec x, fvec& exponent)
+        {
+            uint32_t bits;
+            memcpy(&bits, &x, sizeof(bits));
+
+            exponent = static_cast<float>(static_cast<int32_t>(bits >> 23) - 127);
+            bits = (bits & 0x7fffff) | 0x3f800000;
+
+            fvec mantissa;
+            memcpy(&mantissa, &bits, sizeof(mantissa));
+            return mantissa;
+        }
+
+        static inline fvec fselect_less(fvec a, fvec b, fvec x, fvec y)
+        {
+            return a < b ? x : y;
+        }
+
+        static inline fvec fload_u8(const uint8_t* p)
+        {
+            return *p;
+        }
+
+        static inline fvec fload_s16(const uint8_t* p)
+        {
+            int16_t sample;
+            memcpy(&sample, p, sizeof(sample));
+            return sample;
+        }
+
+        static inline fvec fload_s24(const uint8_t* p)
+        {
+            // In the top three bytes, then shifted down to sign-extend
+            uint32_t bits = (static_cast<uint32_t>(p[0]) << 8) |
+                            (static_cast<uint32_t>(p[1]) << 16) |
+                            (static_cast<uint32_t>(p[2]) << 24);
+
+            return static_cast<float>(static_cast<int32_t>(bits) >> 8);
+        }
+
+        static inline fvec fload_s32(const uint8_t* p)
+        {
+            int32_t sample;
+            memcpy(&sample, p, sizeof(sample));
+            return static_cast<float>(sample);
+        }
+
+        static inline fvec fload_f64(const uint8_t* p)
+        {
+            double sample;
+            memcpy(&sample, p, sizeof(sample));
+            return static_cast<float>(sample);
+        }
+    };
+
+    template<typename V>
+    inline void radix2_pass(float* data, size_t size, size_t half, const float* twiddles)
+    {
+        if (half < V::WIDTH) {
+            radix2_pass<typename V::half_ops>(data, size, half, twiddles);
+            return;
+        }
+
+        for (size_t group = 0; group < size; group += 2 * half) {
+            float* even = data + 2 * group;
+            float* odd = even + 2 * half;
+
+            for (size_t j = 0; j < half; j += V::WIDTH) {
+                typename V::vec e = V::load(even + 2 * j),
+                                t = V::mul(V::load(twiddles + 2 * j), V::load(odd + 2 * j));
+
+                V::store(even + 2 * j, V::add(e, t));
+                V::store(odd + 2 * j, V::sub(e, t));
+            }
+        }
+    }
+
+    template<typename V>
+    inline void radix4_pass(float* data,
+                     size_t size,
+                     size_t half,
+                     const float* twiddles,
+                     const float* next_twiddles)
+    {
+        if (half < V::WIDTH) {
+            radix4_pass<typename V::half_ops>(data, size, half, twiddles, next_twiddles);
+            return;
+        }
+
+        // Each group of 4 * half values goes through the `half` stage as two
+        // independent radix-2 butterflies and then through the 2 * half
+        // stage, without being written back in between
+        for (size_t group = 0; group < size; group += 4 * half) {
+            float* x0 = data + 2 * group;
+            float* x1 = x0 + 2 * half;
+            float* x2 = x1 + 2 * half;
+            float* x3 = x2 + 2 * half;
+
+            for (size_t j = 0; j < half; j += V::WIDTH) {
+                typename V::vec w = V::load(twiddles + 2 * j),
+                                a0 = V::load(x0 + 2 * j),
+                                a2 = V::load(x2 + 2 * j),
+                                t1 = V::mul(w, V::load(x1 + 2 * j)),
+                                t3 = V::mul(w, V::load(x3 + 2 * j));
+
+                typename V::vec b0 = V::add(a0, t1),
+                                b1 = V::sub(a0, t1),
+                                b2 = V::add(a2, t3),
+                                b3 = V::sub(a2, t3);
+
+                typename V::vec u2 = V::mul(V::load(next_twiddles + 2 * j), b2),
+                                u3 = V::mul(V::load(next_twiddles + 2 * (j + half)), b3);
+
+                V::store(x0 + 2 * j, V::add(b0, u2));
+                V::store(x2 + 2 * j, V::sub(b0, u2));
+                V::store(x1 + 2 * j, V::add(b1, u3));
+                V::store(x3 + 2 * j, V::sub(b1, u3));
+            }
+        }
+    }
+
+    // The radix-4 passes of a transform of a fixed size, from the stage of
+    // length `Half` on, each with its sizes known at compile time
+    template<typename V, size_t Size, size_t Half, bool Done = (Half >= Size)>
+    struct fixed_fft_stages {
+        static inline void run(float* data, const float* twiddles)
+        {
+            radix4_pass<V>(data, Size, Half, twiddles + 2 * (Half - 1), twiddles + 2 * (2 * Half - 1));
+            fixed_fft_stages<V, Size, 4 * Half>::run(data, twiddles);
+        }
+    };
+
+    template<typename V, size_t Size, size_t Half>
+    struct fixed_fft_stages<V, Size, Half, true> {
+        static inline void run(float*, const float*)
+        {
+        }
+    };
+
+    // A whole transform of Size interleaved complex values, in the same
+    // order of operations as fft_plan's runtime radix-2 path
+    template<typename V, size_t Size>
+    void fixed_fft(float* data)
+    {
+        const wavalyzer::fixed_fft_tables_t<Size>& tables = wavalyzer::fixed_fft_tables<Size>::VALUE;
+
+        for (size_t i = 0; i < Size; i++) {
+            size_t j = tables.bit_reversal[i];
+            if (i < j) {
+                float re = data[2 * i], im = data[2 * i + 1];
+                data[2 * i] = data[2 * j];
+                data[2 * i + 1] = data[2 * j + 1];
+                data[2 * j] = re;
+                data[2 * j + 1] = im;
+            }
+        }
+
+        const bool ODD_STAGES = wavalyzer::fixed_fft_log2(Size) % 2 == 1;
+        if (ODD_STAGES) {
+            radix2_pass<V>(data, Size, 1, tables.twiddles);
+        }
+
+        fixed_fft_stages<V, Size, ODD_STAGES ? 2 : 1>::run(data, tables.twiddles);
+    }
+
+    template<typename V>
+    void magnitudes(const float* data, size_t count, float* destination)
+    {
+        size_t i = 0;
+        for (; i + V::MAGNITUDE_WIDTH <= count; i += V::MAGNITUDE_WIDTH) {
+            V::magnitudes(data + 2 * i, destination + i);
+        }
+
+        for (; i < count; i++) {
+            scalar_ops::magnitudes(data + 2 * i, destination + i);
+        }
+    }
+
+    // Complex multiplication on split real and imaginary vectors, matching
+    // scalar_ops::mul exactly so batched and single transforms agree
+    template<typename V>
+    inline void split_mul(typename V::fvec a_re,
+                          typename V::fvec a_im,
+                          typename V::fvec b_re,
+                          typename V::fvec b_im,
+                          typename V::fvec& re,
+                          typename V::fvec& im)
+    {
+        re = V::fsub(V::fmul(a_re, b_re), V::fmul(a_im, b_im));
+        im = V::fadd(V::fmul(a_im, b_re), V::fmul(a_re, b_im));
+    }
+
+    // The butterflies of radix2_pass, each applied to `count` frames
+    template<typename V>
+    void batch_radix2_butterfly(float* even_re,
+                                float* even_im,
+                                float* odd_re,
+                                float* odd_im,
+                                size_t count,
+                                float w_re,
+                                float w_im)
+    {
+        typename V::fvec wr = V::fset(w_re),
+                         wi = V::fset(w_im);
+
+        size_t f = 0;
+        for (; f + V::FLOAT_WIDTH <= count; f += V::FLOAT_WIDTH) {
+            typename V::fvec er = V::fload(even_re + f),
+                             ei = V::fload(even_im + f),
+                             tr, ti;
+
+            split_mul<V>(wr, wi, V::fload(odd_re + f), V::fload(odd_im + f), tr, ti);
+
+            V::fstore(even_re + f, V::fadd(er, tr));
+            V::fstore(even_im + f, V::fadd(ei, ti));
+            V::fstore(odd_re + f, V::fsub(er, tr));
+            V::fstore(odd_im + f, V::fsub(ei, ti));
+        }
+
+        if (f < count) {
+            batch_radix2_butterfly<typename V::half_ops>(even_re + f, even_im + f, odd_re + f, odd_im + f,
+                                                         count - f, w_re, w_im);
+        }
+    }
+
+    template<typename V>
+    void batch_radix2_pass(float* re,
+                           float* im,
+                           size_t size,
+                           size_t batch,
+                           size_t half,
+                           const float* twiddles)
+    {
+        for (size_t group = 0; group < size; group += 2 * half) {
+            for (size_t j = 0; j < half; j++) {
+                size_t even = (group + j) * batch,
+                       odd = (group + half + j) * batch;
+
+                batch_radix2_butterfly<V>(re + even, im + even, re + odd, im + odd,
+                                          batch, twiddles[2 * j], twiddles[2 * j + 1]);
+            }
+        }
+    }
+
+    // The butterflies of radix4_pass, each applied to `count` frames; x[i]
+    // points at frame 0 of the i-th quarter's value
+    template<typename V>
+    void batch_radix4_butterfly(float* const* x_re,
+                                float* const* x_im,
+                                size_t count,
+                                const float* w,
+                                const float* next_w,
+                                const float* next_w2)
+    {
+        typename V::fvec wr = V::fset(w[0]), wi = V::fset(w[1]),
+                         nr = V::fset(next_w[0]), ni = V::fset(next_w[1]),
+                         mr = V::fset(next_w2[0]), mi = V::fset(next_w2[1]);
+
+        size_t f = 0;
+        for (; f + V::FLOAT_WIDTH <= count; f += V::FLOAT_WIDTH) {
+            typename V::fvec a0r = V::fload(x_re[0] + f), a0i = V::fload(x_im[0] + f),
+                             a2r = V::fload(x_re[2] + f), a2i = V::fload(x_im[2] + f),
+                             t1r, t1i, t3r, t3i;
+
+            split_mul<V>(wr, wi, V::fload(x_re[1] + f), V::fload(x_im[1] + f), t1r, t1i);
+            split_mul<V>(wr, wi, V::fload(x_re[3] + f), V::fload(x_im[3] + f), t3r, t3i);
+
+            typename V::fvec b0r = V::fadd(a0r, t1r), b0i = V::fadd(a0i, t1i),
+                             b1r = V::fsub(a0r, t1r), b1i = V::fsub(a0i, t1i),
+                             b2r = V::fadd(a2r, t3r), b2i = V::fadd(a2i, t3i),
+                             b3r = V::fsub(a2r, t3r), b3i = V::fsub(a2i, t3i),
+                             u2r, u2i, u3r, u3i;
+
+            split_mul<V>(nr, ni, b2r, b2i, u2r, u2i);
+            split_mul<V>(mr, mi, b3r, b3i, u3r, u3i);
+
+            V::fstore(x_re[0] + f, V::fadd(b0r, u2r));
+            V::fstore(x_im[0] + f, V::fadd(b0i, u2i));
+            V::fstore(x_re[2] + f, V::fsub(b0r, u2r));
+            V::fstore(x_im[2] + f, V::fsub(b0i, u2i));
+            V::fstore(x_re[1] + f, V::fadd(b1r, u3r));
+            V::fstore(x_im[1] + f, V::fadd(b1i, u3i));
+            V::fstore(x_re[3] + f, V::fsub(b1r, u3r));
+            V::fstore(x_im[3] + f, V::fsub(b1i, u3i));
+        }
+
+        if (f < count) {
+            float* rest_re[4] = { x_re[0] + f, x_re[1] + f, x_re[2] + f, x_re[3] + f };
+            float* rest_im[4] = { x_im[0] + f, x_im[1] + f, x_im[2] + f, x_im[3] + f };
+
+            batch_radix4_butterfly<typename V::half_ops>(rest_re, rest_im, count - f, w, next_w, next_w2);
+        }
+    }
+
+    template<typename V>
+    void batch_radix4_pass(float* re,
+                           float* im,
+                           size_t size,
+                           size_t batch,
+                           size_t half,
+                           const float* twiddles,
+                           const float* next_twiddles)
+    {
+        for (size_t group = 0; group < size; group += 4 * half) {
+            for (size_t j = 0; j < half; j++) {
+                float* x_re[4];
+                float* x_im[4];
+                for (size_t q = 0; q < 4; q++) {
+                    size_t offset = (group + q * half + j) * batch;
+                    x_re[q] = re + offset;
+                    x_im[q] = im + offset;
+                }
+
+                batch_radix4_butterfly<V>(x_re, x_im, batch, twiddles + 2 * j,
+                                          next_twiddles + 2 * j, next_twiddles + 2 * (j + half));
+            }
+        }
+    }
+
+    template<typename V>
+    void split_magnitudes(const float* re, const float* im, size_t count, float* destination)
+    {
+        size_t i = 0;
+        for (; i + V::FLOAT_WIDTH <= count; i += V::FLOAT_WIDTH) {
+            typename V::fvec r = V::fload(re + i),
+                             m = V::fload(im + i);
+
+            V::fstore(destination + i, V::fsqrt(V::fadd(V::fmul(r, r), V::fmul(m, m))));
+        }
+
+        for (; i < count; i++) {
+            destination[i] = sqrtf(re[i] * re[i] + im[i] * im[i]);
+        }
+    }
+
+    template<typename V>
+    void batch_window_pack(const float* samples,
+                           const float* window,
+                           size_t half,
+                           const size_t* reversal,
+                           size_t batch,
+                           size_t frame,
+                           float* re,
+                           float* im)
+    {
+        // The products come out interleaved as (re, im) pairs and are then
+        // scattered to their bit-reversed positions
+        float products[2 * V::FLOAT_WIDTH];
+
+        size_t j = 0;
+        for (; j + V::FLOAT_WIDTH <= half; j += V::FLOAT_WIDTH) {
+            const float* s = samples + 2 * j;
+            const float* w = window + 2 * j;
+
+            V::fstore(products, V::fmul(V::fload(s), V::fload(w)));
+            V::fstore(products + V::FLOAT_WIDTH,
+                      V::fmul(V::fload(s + V::FLOAT_WIDTH), V::fload(w + V::FLOAT_WIDTH)));
+
+            for (size_t l = 0; l < V::FLOAT_WIDTH; l++) {
+                size_t i = reversal[j + l] * batch + frame;
+                re[i] = products[2 * l];
+                im[i] = products[2 * l + 1];
+            }
+        }
+
+        for (; j < half; j++) {
+            size_t i = reversal[j] * batch + frame;
+            re[i] = samples[2 * j] * window[2 * j];
+            im[i] = samples[2 * j + 1] * window[2 * j + 1];
+        }
+    }
+
+    // 20 log10(x), to within 1e-4 dB of the exact value for every normal
+    // float. Anything smaller, silence included, counts as FLT_MIN.
+    template<typename V>
+    inline typename V::fvec level_to_db(typename V::fvec x)
+    {
+        typedef typename V::fvec fvec;
+
+        fvec exponent,
+             mantissa = V::fsplit(V::fmax(x, V::fset(1.17549435e-38f)), exponent);
+
+        // ln m = 2 atanh(t) for t = (m - 1) / (m + 1), which is below 1/3 for
+        // m in [1, 2), so five terms of the series leave an error of 1e-6
+        fvec t = V::fdiv(V::fsub(mantissa, V::fset(1.0f)), V::fadd(mantissa, V::fset(1.0f))),
+             t2 = V::fmul(t, t),
+             series = V::fset(2.0f / 9);
+
+        series = V::fadd(V::fmul(series, t2), V::fset(2.0f / 7));
+        series = V::fadd(V::fmul(series, t2), V::fset(2.0f / 5));
+        series = V::fadd(V::fmul(series, t2), V::fset(2.0f / 3));
+        series = V::fadd(V::fmul(series, t2), V::fset(2.0f));
+
+        // 20 log10(2) and 20 / ln(10)
+        return V::fadd(V::fmul(exponent, V::fset(6.02059991f)),
+                       V::fmul(V::fmul(series, t), V::fset(8.68588964f)));
+    }
+
+    template<typename V>
+    void levels_to_db(const float* levels, size_t count, float* destination)
+    {
+        size_t i = 0;
+        for (; i + V::FLOAT_WIDTH <= count; i += V::FLOAT_WIDTH) {
+            V::fstore(destination + i, level_to_db<V>(V::fload(levels + i)));
+        }
+
+        for (; i < count; i++) {
+            destination[i] = level_to_db<scalar_ops>(levels[i]);
+        }
+    }
+
+    // Signed samples of Bits bits to [-1, 1], the negative ones divided by
+    // 2^(Bits - 1) and the others by 2^(Bits - 1) - 1, without a branch
+    template<typename V, int Bits>
+    inline typename V::fvec scale_signed_pcm(typename V::fvec x)
+    {
+        const float negative = static_cast<float>(1LL << (Bits - 1)),
+                    positive = static_cast<float>((1LL << (Bits - 1)) - 1);
+
+        return V::fdiv(x, V::fselect_less(x, V::fset(0.0f), V::fset(negative), V::fset(positive)));
+    }
+
+    // The sample formats decode_pcm takes, each with its size and how to
+    // decode FLOAT_WIDTH samples of it
+    template<typename V>
+    struct pcm_u8 {
+        static const size_t BYTES = 1;
+
+        static inline typename V::fvec decode(const uint8_t* p)
+        {
+            return V::fsub(V::fmul(V::fset(2.0f), V::fdiv(V::fload_u8(p), V::fset(255.0f))), V::fset(1.0f));
+        }
+    };
+
+    template<typename V>
+    struct pcm_s16 {
+        static const size_t BYTES = 2;
+
+        static inline typename V::fvec decode(const uint8_t* p)
+        {
+            return scale_signed_pcm<V, 16>(V::fload_s16(p));
+        }
+    };
+
+    template<typename V>
+    struct pcm_s24 {
+        static const size_t BYTES = 3;
+
+        static inline typename V::fvec decode(const uint8_t* p)
+        {
+            return scale_signed_pcm<V, 24>(V::fload_s24(p));
+        }
+    };
+
+    template<typename V>
+    struct pcm_s32 {
+        static const size_t BYTES = 4;
+
+        static inline typename V::fvec decode(const uint8_t* p)
+        {
+            return scale_signed_pcm<V, 32>(V::fload_s32(p));
+        }
+    };
+
+    template<typename V>
+    struct pcm_f64 {
+        static const size_t BYTES = 8;
+
+        static inline typename V::fvec decode(const uint8_t* p)
+        {
+            return V::fload_f64(p);
+        }
+    };
+
+    template<typename V, template<typename> class Format>
+    void decode_pcm(const uint8_t* source, size_t count, float* destination)
+    {
+        size_t i = 0;
+        for (; i + V::FLOAT_WIDTH <= count; i += V::FLOAT_WIDTH) {
+            V::fstore(destination + i, Format<V>::decode(source + i * Format<V>::BYTES));
+        }
+
+        for (; i < count; i++) {
+            destination[i] = Format<scalar_ops>::decode(source + i * Format<scalar_ops>::BYTES);
+        }
+    }
+}
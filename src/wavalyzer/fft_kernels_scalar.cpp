@@ -0,0 +1,29 @@
+#include "fft_kernels.hpp"
+#include "fft_kernels_impl.hpp"
+
+const wavalyzer::fft_kernels_t wavalyzer::FFT_KERNELS_SCALAR = {
+    "scalar",
+    radix2_pass<scalar_ops>,
+    radix4_pass<scalar_ops>,
+    magnitudes<scalar_ops>,
+    {
+        fixed_fft<scalar_ops, 64>,
+        fixed_fft<scalar_ops, 128>,
+        fixed_fft<scalar_ops, 256>,
+        fixed_fft<scalar_ops, 512>,
+        fixed_fft<scalar_ops, 1024>,
+        fixed_fft<scalar_ops, 2048>,
+        fixed_fft<scalar_ops, 4096>,
+        fixed_fft<scalar_ops, 8192>
+    },
+    batch_radix2_pass<scalar_ops>,
+    batch_radix4_pass<scalar_ops>,
+    split_magnitudes<scalar_ops>,
+    batch_window_pack<scalar_ops>,
+    levels_to_db<scalar_ops>,
+    decode_pcm<scalar_ops, pcm_u8>,
+    decode_pcm<scalar_ops, pcm_s16>,
+    decode_pcm<scalar_ops, pcm_s24>,
+    decode_pcm<scalar_ops, pcm_s32>,
+    decode_pcm<scalar_ops, pcm_f64>
+};
@@ -0,0 +1,175 @@
+#pragma once
+#include "fft_kernels_impl.hpp"
+#include <emmintrin.h>
+
+// Vector operations on 128-bit SSE2 registers; see fft_kernels_impl.hpp.
+namespace {
+    struct sse2_ops {
+        // Used for whatever is too short for a full vector
+        typedef scalar_ops half_ops;
+
+        static const size_t WIDTH = 2;
+        static const size_t MAGNITUDE_WIDTH = 4;
+
+        typedef __m128 vec;
+
+        static inline vec load(const float* p)
+        {
+            return _mm_loadu_ps(p);
+        }
+
+        static inline void store(float* p, vec v)
+        {
+            _mm_storeu_ps(p, v);
+        }
+
+        static inline vec add(vec a, vec b)
+        {
+            return _mm_add_ps(a, b);
+        }
+
+        static inline vec sub(vec a, vec b)
+        {
+            return _mm_sub_ps(a, b);
+        }
+
+        static inline vec mul(vec a, vec b)
+        {
+            // SSE2 has no addsub, so negate the products landing in the
+            // real lanes instead
+            const vec real_lanes = _mm_castsi128_ps(_mm_set_epi32(0, 0x80000000, 0, 0x80000000));
+
+            vec b_re = _mm_shuffle_ps(b, b, _MM_SHUFFLE(2, 2, 0, 0)),
+                b_im = _mm_shuffle_ps(b, b, _MM_SHUFFLE(3, 3, 1, 1)),
+                a_swapped = _mm_shuffle_ps(a, a, _MM_SHUFFLE(2, 3, 0, 1));
+
+            vec p = _mm_mul_ps(a, b_re),
+                q = _mm_xor_ps(_mm_mul_ps(a_swapped, b_im), real_lanes);
+
+            return _mm_add_ps(p, q);
+        }
+
+        static inline void magnitudes(const float* src, float* dst)
+        {
+            vec lo = _mm_loadu_ps(src),
+                hi = _mm_loadu_ps(src + 4);
+
+            lo = _mm_mul_ps(lo, lo);
+            hi = _mm_mul_ps(hi, hi);
+
+            vec re = _mm_shuffle_ps(lo, hi, _MM_SHUFFLE(2, 0, 2, 0)),
+                im = _mm_shuffle_ps(lo, hi, _MM_SHUFFLE(3, 1, 3, 1));
+
+            _mm_storeu_ps(dst, _mm_sqrt_ps(_mm_add_ps(re, im)));
+        }
+
+        static const size_t FLOAT_WIDTH = 4;
+
+        typedef __m128 fvec;
+
+        static inline fvec fload(const float* p)
+        {
+            return _mm_loadu_ps(p);
+        }
+
+        static inline void fstore(float* p, fvec v)
+        {
+            _mm_storeu_ps(p, v);
+        }
+
+        static inline fvec fset(float f)
+        {
+            return _mm_set1_ps(f);
+        }
+
+        static inline fvec fadd(fvec a, fvec b)
+        {
+            return _mm_add_ps(a, b);
+        }
+
+        static inline fvec fsub(fvec a, fvec b)
+        {
+            return _mm_sub_ps(a, b);
+        }
+
+        static inline fvec fmul(fvec a, fvec b)
+        {
+            return _mm_mul_ps(a, b);
+        }
+
+        static inline fvec fdiv(fvec a, fvec b)
+        {
+            return _mm_div_ps(a, b);
+        }
+
+        static inline fvec fmax(fvec a, fvec b)
+        {
+            return _mm_max_ps(a, b);
+        }
+
+        static inline fvec fsqrt(fvec a)
+        {
+            return _mm_sqrt_ps(a);
+        }
+
+        static inline fvec fsplit(fvec x, fvec& exponent)
+        {
+            __m128i bits = _mm_castps_si128(x);
+
+            exponent = _mm_cvtepi32_ps(_mm_sub_epi32(_mm_srli_epi32(bits, 23), _mm_set1_epi32(127)));
+            return _mm_castsi128_ps(_mm_or_si128(_mm_and_si128(bits, _mm_set1_epi32(0x7fffff)),
+                                                 _mm_set1_epi32(0x3f800000)));
+        }
+
+        static inline fvec fselect_less(fvec a, fvec b, fvec x, fvec y)
+        {
+            fvec mask = _mm_cmplt_ps(a, b);
+            return _mm_or_ps(_mm_and_ps(mask, x), _mm_andnot_ps(mask, y));
+        }
+
+        static inline fvec fload_u8(const uint8_t* p)
+        {
+            int32_t bytes;
+            memcpy(&bytes, p, sizeof(bytes));
+
+            __m128i zero = _mm_setzero_si128(),
+                    words = _mm_unpacklo_epi8(_mm_cvtsi32_si128(bytes), zero);
+
+            return _mm_cvtepi32_ps(_mm_unpacklo_epi16(words, zero));
+        }
+
+        static inline fvec fload_s16(const uint8_t* p)
+        {
+            // Each sample in the top half of a lane, shifted down to
+            // sign-extend
+            __m128i words = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(p));
+            return _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(words, words), 16));
+        }
+
+        static inline fvec fload_s24(const uint8_t* p)
+        {
+            // SSE2 cannot shuffle bytes, so the lanes are put together one
+            // by one, each sample in the top three bytes
+            int32_t lanes[4];
+            for (size_t i = 0; i < 4; i++) {
+                lanes[i] = static_cast<int32_t>((static_cast<uint32_t>(p[3 * i]) << 8) |
+                                                (static_cast<uint32_t>(p[3 * i + 1]) << 16) |
+                                                (static_cast<uint32_t>(p[3 * i + 2]) << 24));
+            }
+
+            __m128i samples = _mm_loadu_si128(reinterpret_cast<const __m128i*>(lanes));
+            return _mm_cvtepi32_ps(_mm_srai_epi32(samples, 8));
+        }
+
+        static inline fvec fload_s32(const uint8_t* p)
+        {
+            return _mm_cvtepi32_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p)));
+        }
+
+        static inline fvec fload_f64(const uint8_t* p)
+        {
+            const double* samples = reinterpret_cast<const double*>(p);
+            return _mm_movelh_ps(_mm_cvtpd_ps(_mm_loadu_pd(samples)), _mm_cvtpd_ps(_mm_loadu_pd(samples + 2)));
+        }
+    };
+}
@@ -8,6 +8,9 @@ using namespace std;
 
 const int MAX_CLICK_DISTANCE = 5;
 
+// How often a diagram that is not complete yet is checked for changes
+const int POLL_INTERVAL_MS = 50;
+
 const int WINDOW_WIDTH = 1200;
 const int WINDOW_HEIGHT = 600;
 const int VRULE_WEIGHT = 2;
@@ -58,7 +61,12 @@ diagram_window::diagram_window(diagram* _diagram) : handler(nullptr),
     }
 }
 
-void diagram_window::set_diagram(diagram* new_diagram)
+int diagram_window::get_plot_width()
+{
+    return ONE_X - ZERO_X;
+}
+
+void diagram_window::set_diagram(diagram* new_diagram, bool keep_x_range)
 {
     diag = new_diagram;
     dragging = false;
@@ -67,7 +75,7 @@ void diagram_window::set_diagram(diagram* new_diagram)
     mouse_x = 0;
     click_mark_x = 0;
 
-    x_range = diag->get_full_x_range();
+    x_range = keep_x_range ? check_range(x_range) : diag->get_full_x_range();
     diag->set_x_range(x_range);
 
     create_x_labels();
@@ -321,6 +329,13 @@ void diagram_window::start()
 {
     while (window->isOpen())
     {
+        // Checked before the changes, so that none are missed after it
+        bool complete = diag->is_complete();
+        if (diag->has_changed()) {
+            create_texts();
+            dirty = true;
+        }
+
         if (dirty) {
             window->clear(sf::Color(BACK_COLOR));
 
@@ -335,7 +350,12 @@ void diagram_window::start()
         }
 
         sf::Event event;
-        window->waitEvent(event);
+        if (complete) {
+            window->waitEvent(event);
+        } else if (!window->pollEvent(event)) {
+            sf::sleep(sf::milliseconds(POLL_INTERVAL_MS));
+            continue;
+        }
 
         if (event.type == sf::Event::Closed) {
             window->close();
@@ -49,6 +49,11 @@ namespace wavalyzer::gui {
 
         virtual void set_x_range(std::pair<float, float> new_range) = 0;
 
+        // A diagram of data that is still coming in is polled, and redrawn
+        // whenever it has changed, until it is complete
+        virtual bool is_complete() { return true; }
+        virtual bool has_changed() { return false; }
+
         virtual void draw(sf::RenderTarget* target, std::pair<int, int> bottom_left, std::pair<int, int> size) = 0;
         virtual void draw_to_pdf(sfml_pdf& pdf, std::pair<int, int> bottom_left, std::pair<int, int> size) = 0;
 
@@ -108,8 +113,13 @@ namespace wavalyzer::gui {
     public:
         diagram_window(diagram* _diagram);
 
+        // Columns of pixels that diagrams are drawn in
+        static int get_plot_width();
+
         void set_event_handler(diagram_event_handler* new_handler);
-        void set_diagram(diagram* new_diagram);
+        // Keeping the x range suits a diagram of the same data in another
+        // form
+        void set_diagram(diagram* new_diagram, bool keep_x_range = false);
         void start();
     };
 }
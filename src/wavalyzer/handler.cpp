@@ -7,7 +7,8 @@ using namespace std;
 using namespace wavalyzer;
 using namespace wavalyzer::gui;
 
-main_diagram_event_handler::main_diagram_event_handler(const vector<fft_result_t>& _ffts,
+main_diagram_event_handler::main_diagram_event_handler(const vector<const spectrogram_matrix*>& _spectra,
+                                                       const vector<int>& window_sizes,
                                                        int _min_freq,
                                                        int _max_freq,
                                                        int _step_freq,
@@ -15,39 +16,87 @@ main_diagram_event_handler::main_diagram_event_handler(const vector<fft_result_t
                                                        int _histogram_buckets) :
 
                                                        diagram_event_handler(),
-                                                       ffts(_ffts),
+                                                       spectra(_spectra),
                                                        min_freq(_min_freq),
                                                        max_freq(_max_freq),
                                                        step_freq(_step_freq),
                                                        step_ms(_step_ms),
                                                        histogram_buckets(_histogram_buckets),
                                                        hist(nullptr),
-                                                       spect(nullptr),
+                                                       current(0),
+                                                       hist_ms(0),
                                                        save_counter(0)
 {
-    spect = new spectrogram(ffts, step_ms, min_freq, max_freq, step_freq);
+    for (size_t i = 0; i < spectra.size(); i++) {
+        string title = "Spectrogram";
+        if (spectra.size() > 1) {
+            title += " (" + to_string(window_sizes[i]) + " samples, " +
+                     to_string(i + 1) + "/" + to_string(spectra.size()) + ")";
+        }
+
+        spects.push_back(new spectrogram(*spectra[i], step_ms, min_freq, max_freq, step_freq, title));
+    }
 }
 
-void main_diagram_event_handler::on_click_mark(float x)
+void main_diagram_event_handler::set_source(size_t resolution, lazy_analyzer* analyzer, size_t config)
 {
-    if (hist != nullptr) {
-        return;
+    spects[resolution]->set_source(analyzer, config);
+}
+
+bool main_diagram_event_handler::show_histogram(int ms)
+{
+    // Larger windows fit fewer times into the file
+    int column = max(0, min(static_cast<int>(round(static_cast<float>(ms) / step_ms)),
+                            static_cast<int>(spectra[current]->get_window_count()) - 1));
+
+    // Before the window itself is analyzed, the nearest one of the preview
+    // does
+    size_t ready_column;
+    const spectrogram_matrix* ready = spects[current]->get_ready_column(column, ready_column);
+    if (ready == nullptr) {
+        return false;
     }
 
-    int ms_nearest = round(x / step_ms);
     if (hist != nullptr) {
         delete hist;
         hist = nullptr;
     }
 
-    hist = new histogram(ffts[ms_nearest], min_freq, max_freq, step_freq, histogram_buckets);
+    hist_ms = ms;
+    hist = new histogram(ready->get_column(ready_column), min_freq, max_freq, step_freq, histogram_buckets);
     parent->set_diagram(hist);
+    return true;
+}
+
+void main_diagram_event_handler::select(size_t resolution)
+{
+    if (resolution >= spects.size() || resolution == current) {
+        return;
+    }
+
+    current = resolution;
+    if (hist == nullptr) {
+        parent->set_diagram(spects[current], true);
+    } else if (!show_histogram(hist_ms)) {
+        delete hist;
+        hist = nullptr;
+        parent->set_diagram(spects[current]);
+    }
+}
+
+void main_diagram_event_handler::on_click_mark(float x)
+{
+    if (hist != nullptr) {
+        return;
+    }
+
+    show_histogram(static_cast<int>(x));
 }
 
 void main_diagram_event_handler::set_parent(diagram_window* new_parent)
 {
     parent = new_parent;
-    parent->set_diagram(spect);
+    parent->set_diagram(spects[current]);
 }
 
 void main_diagram_event_handler::on_key_press(sf::Keyboard::Key key)
@@ -55,7 +104,11 @@ void main_diagram_event_handler::on_key_press(sf::Keyboard::Key key)
     if (key == sf::Keyboard::BackSpace && hist != nullptr) {
         delete hist;
         hist = nullptr;
-        parent->set_diagram(spect);
+        parent->set_diagram(spects[current]);
+    } else if (key == sf::Keyboard::Tab) {
+        select((current + 1) % spects.size());
+    } else if (key >= sf::Keyboard::Num1 && key <= sf::Keyboard::Num9) {
+        select(key - sf::Keyboard::Num1);
     } else if (key == sf::Keyboard::P) {
         sfml_pdf pdf;
         cout << "[+] Please wait, rendering the diagram..." << endl;
@@ -63,7 +116,7 @@ void main_diagram_event_handler::on_key_press(sf::Keyboard::Key key)
         if (hist != nullptr) {
             pdf.draw_diagram(hist, false);
         } else {
-            pdf.draw_diagram(spect, true);
+            pdf.draw_diagram(spects[current], true);
         }
 
         string filename = "diagram_" + to_string(++save_counter) + ".pdf";
@@ -82,7 +135,7 @@ main_diagram_event_handler::~main_diagram_event_handler()
         delete hist;
     }
 
-    if (spect != nullptr) {
+    for (spectrogram* spect : spects) {
         delete spect;
     }
 }
@@ -1,27 +1,37 @@
 #pragma once
 #include "gui.hpp"
-#include "fft.hpp"
+#include "spectrogram_matrix.hpp"
 #include "histogram.hpp"
 #include "spectrogram.hpp"
 #include <vector>
 
 namespace wavalyzer::gui {
+    // Shows the spectra of one of several window sizes at a time; Tab or
+    // the number keys switch between them
     class main_diagram_event_handler : public diagram_event_handler {
     private:
-        const std::vector<fft_result_t>& ffts;
+        std::vector<const spectrogram_matrix*> spectra;
         int min_freq, max_freq, step_freq, step_ms, histogram_buckets;
         histogram *hist;
-        spectrogram *spect;
-        int save_counter;
+        std::vector<spectrogram*> spects;
+        size_t current;
+        int hist_ms, save_counter;
+
+        bool show_histogram(int ms);
+        void select(size_t resolution);
 
     public:
-        main_diagram_event_handler(const std::vector<fft_result_t>& _ffts,
+        main_diagram_event_handler(const std::vector<const spectrogram_matrix*>& _spectra,
+                                   const std::vector<int>& window_sizes,
                                    int _min_freq,
                                    int _max_freq,
                                    int _step_freq,
                                    int _step_ms,
                                    int _histogram_buckets);
 
+        // The spectra of a resolution are still being analyzed by `analyzer`
+        void set_source(size_t resolution, lazy_analyzer* analyzer, size_t config);
+
         virtual void set_parent(diagram_window* new_parent);
         virtual void on_click_mark(float x);
         virtual void on_key_press(sf::Keyboard::Key key);
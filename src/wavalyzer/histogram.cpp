@@ -11,7 +11,7 @@ const int Y_LABEL_STEP = 12;
 const int MAX_Y = 100;
 const uint32_t BAR_COLOR = 0xf77a1bff;
 
-histogram::histogram(const std::vector<float>& _values,
+histogram::histogram(const spectrogram_column& _values,
                      float _min_hertz,
                      float _max_hertz,
                      float _step_hertz,
@@ -157,7 +157,7 @@ void histogram::update_bars()
 
         float sum = 0.0f;
         for (int j = bucket_left_index; j <= bucket_right_index; j++) {
-            sum += values[j];
+            sum += db_to_sample_level(values[j]);
         }
 
         float value = sum / (bucket_right_index - bucket_left_index + 1);
@@ -1,12 +1,13 @@
 #pragma once
 #include "gui.hpp"
+#include "spectrogram_matrix.hpp"
 #include <vector>
 #include <string>
 
 namespace wavalyzer::gui {
     class histogram : public diagram {
     private:
-        std::vector<float> values;
+        spectrogram_column values;
         float min_hertz, max_hertz, step_hertz;
         size_t buckets;
 
@@ -25,7 +26,7 @@ namespace wavalyzer::gui {
         float get_bucket_start_frequency(int bucket);
 
     public:
-        histogram(const std::vector<float>& _values,
+        histogram(const spectrogram_column& _values,
                   float _min_hertz,
                   float _max_hertz,
                   float _step_hertz,
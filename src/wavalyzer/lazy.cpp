@@ -0,0 +1,387 @@
+#include "lazy.hpp"
+#include "wav.hpp"
+#include <algorithm>
+
+using namespace wavalyzer;
+using namespace std;
+
+// Windows per chunk. The same as a task of stream_analyzer, so that engines
+// which carry state between windows of a call give the same spectra.
+const size_t LAZY_CHUNK_WINDOWS = 512;
+
+const uint8_t CHUNK_PENDING = 0;
+const uint8_t CHUNK_CLAIMED = 1;
+const uint8_t CHUNK_DONE = 2;
+
+lazy_analyzer::lazy_analyzer(const string& engine, const vector<analysis_config_t>& configs, size_t threads)
+    : thread_count(max<size_t>(1, threads)),
+      preview_columns(0),
+      focus_resolution(0),
+      focus_first(0),
+      focus_end(0),
+      refining(false),
+      stopping(false),
+      failed(false)
+{
+    if (configs.empty()) {
+        throw stream_exception("Nothing to analyze");
+    }
+
+    for (const analysis_config_t& config : configs) {
+        unique_ptr<resolution_t> resolution(new resolution_t());
+        resolution->window_size = config.window_size;
+        init_pass(resolution->full, 0, 1, nullptr);
+        init_pass(resolution->preview, 0, 1, nullptr);
+
+        for (size_t t = 0; t < thread_count; t++) {
+            resolution->engines.push_back(make_analysis_engine(engine, config));
+        }
+
+        resolution->bucket_count = resolution->engines[0]->get_bucket_count();
+        resolutions.push_back(move(resolution));
+    }
+}
+
+lazy_analyzer::~lazy_analyzer()
+{
+    stop();
+}
+
+void lazy_analyzer::init_pass(pass_t& pass, size_t window_count, size_t stride, spectrogram_matrix* spectra)
+{
+    pass.window_count = window_count;
+    pass.stride = stride;
+    pass.spectra = spectra;
+    pass.windows_done = 0;
+
+    pass.chunk_count = (window_count + LAZY_CHUNK_WINDOWS - 1) / LAZY_CHUNK_WINDOWS;
+    pass.chunks.reset(new atomic<uint8_t>[pass.chunk_count]);
+    for (size_t chunk = 0; chunk < pass.chunk_count; chunk++) {
+        pass.chunks[chunk].store(CHUNK_PENDING, memory_order_relaxed);
+    }
+}
+
+void lazy_analyzer::start(const string& filename, const vector<output_t>& outputs, size_t _preview_columns)
+{
+    if (outputs.size() != resolutions.size()) {
+        throw stream_exception("Expected one output per analysis config");
+    }
+
+    if (!workers.empty()) {
+        throw stream_exception("The analysis has already been started");
+    }
+
+    preview_columns = _preview_columns;
+
+    for (size_t c = 0; c < outputs.size(); c++) {
+        resolution_t& resolution = *resolutions[c];
+        size_t window_count = outputs[c].window_count;
+
+        resolution.output = outputs[c];
+        resolution.output.spectra->resize(window_count, resolution.bucket_count);
+        init_pass(resolution.full, window_count, 1, resolution.output.spectra);
+
+        // A preview of fewer windows than columns would show nothing the
+        // full analysis does not, at nearly its cost
+        size_t stride = preview_columns > 0 ? window_count / preview_columns : 0;
+        if (stride >= 2) {
+            size_t preview_count = (window_count + stride - 1) / stride;
+            resolution.preview_spectra.set_format(resolution.output.spectra->get_format());
+            resolution.preview_spectra.resize(preview_count, resolution.bucket_count);
+            init_pass(resolution.preview, preview_count, stride, &resolution.preview_spectra);
+        }
+    }
+
+    for (size_t worker = 0; worker < thread_count; worker++) {
+        workers.emplace_back([this, filename, worker]() {
+            try {
+                analyze_chunks(filename, worker);
+            } catch (...) {
+                fail();
+            }
+        });
+    }
+}
+
+bool lazy_analyzer::is_adapted(const resolution_t& resolution) const
+{
+    return resolution.preview.chunk_count > 0;
+}
+
+void lazy_analyzer::focus(size_t config, size_t first, size_t end)
+{
+    {
+        lock_guard<mutex> guard(lock);
+        focus_resolution = min(config, resolutions.size() - 1);
+        focus_first = first;
+        focus_end = max(first, end);
+
+        // The preview has about a window per column for the whole file;
+        // a narrower view needs more than that
+        const resolution_t& resolution = *resolutions[focus_resolution];
+        refining = focus_end - focus_first < resolution.preview.stride * preview_columns;
+    }
+
+    wake.notify_all();
+}
+
+// Takes the first pending chunk of the previews, then of the full passes.
+// Either way, the config in focus goes first, from the focus onwards and
+// wrapping around, and then the others in order. Of a full pass with an
+// adapted hop, only the chunks in view are taken, and only while refining.
+bool lazy_analyzer::find_chunk(size_t& resolution, pass_t*& pass, size_t& chunk)
+{
+    for (int preview = 1; preview >= 0; preview--) {
+        for (size_t r = 0; r <= resolutions.size(); r++) {
+            size_t c = r == 0 ? focus_resolution : r - 1;
+            if (r > 0 && c == focus_resolution) {
+                continue;
+            }
+
+            resolution_t& candidate_resolution = *resolutions[c];
+            pass_t& candidate_pass = preview ? candidate_resolution.preview : candidate_resolution.full;
+
+            size_t chunk_count = candidate_pass.chunk_count,
+                   first = 0,
+                   count = chunk_count;
+
+            if (c == focus_resolution) {
+                first = focus_first / candidate_pass.stride / LAZY_CHUNK_WINDOWS;
+            }
+
+            if (!preview && is_adapted(candidate_resolution)) {
+                size_t end = (focus_end + LAZY_CHUNK_WINDOWS - 1) / LAZY_CHUNK_WINDOWS;
+                first = min(first, chunk_count);
+                count = c == focus_resolution && refining ? min(end, chunk_count) - min(first, end) : 0;
+            } else if (first >= chunk_count) {
+                first = 0;
+            }
+
+            for (size_t i = 0; i < count; i++) {
+                size_t candidate = (first + i) % chunk_count;
+                if (candidate_pass.chunks[candidate].load(memory_order_relaxed) == CHUNK_PENDING) {
+                    resolution = c;
+                    pass = &candidate_pass;
+                    chunk = candidate;
+                    return true;
+                }
+            }
+        }
+    }
+
+    return false;
+}
+
+bool lazy_analyzer::claim_chunk(size_t& resolution, pass_t*& pass, size_t& chunk)
+{
+    unique_lock<mutex> guard(lock);
+
+    while (!stopping && !failed) {
+        if (find_chunk(resolution, pass, chunk)) {
+            pass->chunks[chunk].store(CHUNK_CLAIMED, memory_order_relaxed);
+            return true;
+        }
+
+        // Only an adapted hop leaves windows for later, when the focus
+        // moves to them
+        bool waiting = false;
+        for (size_t c = 0; c < resolutions.size(); c++) {
+            waiting = waiting || (is_adapted(*resolutions[c]) && !is_done(c));
+        }
+
+        if (!waiting) {
+            return false;
+        }
+
+        wake.wait(guard);
+    }
+
+    return false;
+}
+
+void lazy_analyzer::analyze_chunks(const string& filename, size_t worker)
+{
+    wav_file file(filename);
+
+    vector<float> samples;
+    vector<size_t> starts;
+    vector<float> buckets;
+    size_t r, chunk;
+    pass_t* pass;
+
+    while (!failed && claim_chunk(r, pass, chunk)) {
+        resolution_t& resolution = *resolutions[r];
+        size_t first = chunk * LAZY_CHUNK_WINDOWS,
+               count = min(LAZY_CHUNK_WINDOWS, pass->window_count - first),
+               total = file.get_total_samples();
+
+        starts.clear();
+        for (size_t w = first; w < first + count; w++) {
+            starts.push_back(resolution.output.window_start(w * pass->stride));
+            if (starts.size() > 1 && starts.back() < starts[starts.size() - 2]) {
+                throw stream_exception("Window starts must not decrease");
+            }
+        }
+
+        // Reads every run of overlapping windows in one go and skips the
+        // gaps between runs. samples[i] is sample i + offset of the file,
+        // from the last gap that was skipped on.
+        size_t offset = min(starts.front(), total), head = offset;
+        samples.clear();
+        file.seek_sample(offset);
+
+        for (size_t w = 0; w < count; w++) {
+            size_t start = starts[w];
+
+            if (start > head && head < total) {
+                size_t skipped = min(start, total) - head;
+                file.seek_sample(head + skipped);
+                offset += skipped;
+                head += skipped;
+            }
+
+            if (start + resolution.window_size > head && head < total) {
+                size_t run_end = start + resolution.window_size;
+                for (size_t ahead = w + 1; ahead < count && starts[ahead] <= run_end; ahead++) {
+                    run_end = max(run_end, starts[ahead] + resolution.window_size);
+                }
+
+                size_t size = samples.size();
+                samples.resize(size + min(run_end, total) - head);
+                file.read_samples(samples.data() + size, samples.size() - size);
+                head = min(run_end, total);
+            }
+
+            starts[w] = start - offset;
+        }
+
+        buckets.resize(count * resolution.bucket_count);
+        resolution.engines[worker]->analyze(samples, starts.data(), count, buckets.data());
+
+        pass->spectra->set_columns(first, count, buckets.data());
+
+        pass->windows_done.fetch_add(count, memory_order_relaxed);
+        pass->chunks[chunk].store(CHUNK_DONE, memory_order_release);
+    }
+}
+
+void lazy_analyzer::fail()
+{
+    {
+        lock_guard<mutex> guard(error_lock);
+        if (!error) {
+            error = current_exception();
+        }
+    }
+
+    {
+        lock_guard<mutex> guard(lock);
+        failed = true;
+    }
+
+    wake.notify_all();
+}
+
+bool lazy_analyzer::is_ready(size_t config, size_t window) const
+{
+    const pass_t& pass = resolutions[config]->full;
+    size_t chunk = window / LAZY_CHUNK_WINDOWS;
+
+    return chunk < pass.chunk_count &&
+           pass.chunks[chunk].load(memory_order_acquire) == CHUNK_DONE;
+}
+
+size_t lazy_analyzer::get_windows_done(size_t config) const
+{
+    return resolutions[config]->full.windows_done.load(memory_order_relaxed);
+}
+
+bool lazy_analyzer::is_done(size_t config) const
+{
+    return get_windows_done(config) == resolutions[config]->full.window_count;
+}
+
+const spectrogram_matrix* lazy_analyzer::get_preview(size_t config) const
+{
+    return is_adapted(*resolutions[config]) ? &resolutions[config]->preview_spectra : nullptr;
+}
+
+size_t lazy_analyzer::get_preview_stride(size_t config) const
+{
+    return resolutions[config]->preview.stride;
+}
+
+bool lazy_analyzer::is_preview_ready(size_t config, size_t index) const
+{
+    const pass_t& pass = resolutions[config]->preview;
+    size_t chunk = index / LAZY_CHUNK_WINDOWS;
+
+    return chunk < pass.chunk_count &&
+           pass.chunks[chunk].load(memory_order_acquire) == CHUNK_DONE;
+}
+
+size_t lazy_analyzer::get_preview_windows_done(size_t config) const
+{
+    return resolutions[config]->preview.windows_done.load(memory_order_relaxed);
+}
+
+bool lazy_analyzer::is_preview_done(size_t config) const
+{
+    return get_preview_windows_done(config) == resolutions[config]->preview.window_count;
+}
+
+bool lazy_analyzer::is_idle()
+{
+    lock_guard<mutex> guard(lock);
+
+    if (failed) {
+        return true;
+    }
+
+    size_t resolution, chunk;
+    pass_t* pass;
+    if (find_chunk(resolution, pass, chunk)) {
+        return false;
+    }
+
+    for (const unique_ptr<resolution_t>& candidate : resolutions) {
+        for (const pass_t* p : { &candidate->full, &candidate->preview }) {
+            for (size_t c = 0; c < p->chunk_count; c++) {
+                if (p->chunks[c].load(memory_order_acquire) == CHUNK_CLAIMED) {
+                    return false;
+                }
+            }
+        }
+    }
+
+    return true;
+}
+
+void lazy_analyzer::stop()
+{
+    {
+        lock_guard<mutex> guard(lock);
+        stopping = true;
+    }
+
+    wake.notify_all();
+
+    for (thread& t : workers) {
+        if (t.joinable()) {
+            t.join();
+        }
+    }
+}
+
+void lazy_analyzer::wait()
+{
+    for (thread& t : workers) {
+        if (t.joinable()) {
+            t.join();
+        }
+    }
+
+    if (error) {
+        rethrow_exception(error);
+    }
+}
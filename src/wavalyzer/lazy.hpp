@@ -0,0 +1,134 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <cstdint>
+#include <exception>
+#include "analysis.hpp"
+#include "spectrogram_matrix.hpp"
+#include "stream.hpp"
+
+namespace wavalyzer {
+    // Analyzes a file in the background, a chunk of windows at a time, right
+    // into spectrogram matrices that can be shown meanwhile. The chunks from
+    // the window passed to focus() onwards go first, then the rest of the
+    // file. Every worker reads the file on its own, seeking to the chunks it
+    // takes, so the order costs nothing.
+    //
+    // Given the number of columns the spectra are shown in, it adapts the
+    // hop to the view instead. A preview pass first analyzes every
+    // get_preview_stride()-th window, about one per column, into a matrix of
+    // its own. After that only the windows in focus are analyzed, and only
+    // once the view is zoomed in far enough to show more of them than the
+    // preview has. The workers then wait for the focus to move; whatever
+    // they analyzed is kept.
+    //
+    // A column may only be read once is_ready() or is_preview_ready() is
+    // true for it, and is never written again after that.
+    class lazy_analyzer {
+    public:
+        struct output_t {
+            size_t window_count;
+            stream_analyzer::window_start_t window_start;
+            spectrogram_matrix* spectra;
+        };
+
+    private:
+        // Every stride-th window of an output, in chunks
+        struct pass_t {
+            size_t window_count, stride, chunk_count;
+            spectrogram_matrix* spectra;
+
+            // The state of every chunk, one of CHUNK_*
+            std::unique_ptr<std::atomic<std::uint8_t>[]> chunks;
+            std::atomic<size_t> windows_done;
+        };
+
+        struct resolution_t {
+            size_t window_size, bucket_count;
+            output_t output;
+
+            // One engine per worker
+            std::vector<std::unique_ptr<analysis_engine>> engines;
+
+            // The preview has no chunks unless the hop is adapted
+            pass_t full, preview;
+            spectrogram_matrix preview_spectra;
+        };
+
+        size_t thread_count, preview_columns;
+        std::vector<std::unique_ptr<resolution_t>> resolutions;
+        std::vector<std::thread> workers;
+
+        // Guards the focus and the claiming of chunks. Idle workers wait on
+        // `wake` for either to change.
+        std::mutex lock;
+        std::condition_variable wake;
+        size_t focus_resolution, focus_first, focus_end;
+
+        // Whether the view is narrow enough for the windows in focus to be
+        // analyzed past the preview
+        bool refining;
+
+        std::atomic<bool> stopping, failed;
+        std::mutex error_lock;
+        std::exception_ptr error;
+
+        void init_pass(pass_t& pass, size_t window_count, size_t stride, spectrogram_matrix* spectra);
+        bool is_adapted(const resolution_t& resolution) const;
+        bool find_chunk(size_t& resolution, pass_t*& pass, size_t& chunk);
+        bool claim_chunk(size_t& resolution, pass_t*& pass, size_t& chunk);
+        void analyze_chunks(const std::string& filename, size_t worker);
+        void fail();
+
+    public:
+        // Throws analysis_exception for an unknown engine name
+        lazy_analyzer(const std::string& engine, const std::vector<analysis_config_t>& configs, size_t threads);
+        ~lazy_analyzer();
+
+        size_t get_bucket_count(size_t config = 0) const {
+            return resolutions[config]->bucket_count;
+        }
+
+        // Sizes the matrices and starts analyzing the file on the workers.
+        // outputs[c] describes the windows of config c, as for
+        // stream_analyzer::run. With preview_columns, the hop is adapted to
+        // a view that many columns wide.
+        void start(const std::string& filename, const std::vector<output_t>& outputs, size_t preview_columns = 0);
+
+        // The windows of a config from `first` to `end` are in view, and are
+        // analyzed before any others
+        void focus(size_t config, size_t first, size_t end);
+
+        bool is_ready(size_t config, size_t window) const;
+        size_t get_windows_done(size_t config) const;
+        bool is_done(size_t config) const;
+
+        // Every get_preview_stride()-th window, or nothing if the hop is not
+        // adapted for the config
+        const spectrogram_matrix* get_preview(size_t config) const;
+        size_t get_preview_stride(size_t config) const;
+        bool is_preview_ready(size_t config, size_t index) const;
+        size_t get_preview_windows_done(size_t config) const;
+        bool is_preview_done(size_t config) const;
+
+        // Nothing is being analyzed, and nothing will be until the focus
+        // moves
+        bool is_idle();
+
+        bool has_failed() const {
+            return failed;
+        }
+
+        // Makes the workers quit after the chunks they are on
+        void stop();
+
+        // Waits for the workers, and rethrows the first error any of them
+        // ran into. With an adapted hop, they only quit on stop().
+        void wait();
+    };
+}
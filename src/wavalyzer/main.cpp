@@ -1,38 +1,157 @@
 #include <iostream>
 #include <iomanip>
 #include <fstream>
+#include <sstream>
 #include <vector>
+#include <algorithm>
+#include <memory>
+#include <chrono>
+#include <set>
+#include <mutex>
+#include <atomic>
+#include <future>
+#include <cerrno>
+#include <glob.h>
+#include <sys/stat.h>
 #include "wav.hpp"
 #include "fft.hpp"
-#include "window.hpp"
+#include "analysis.hpp"
+#include "parallel.hpp"
+#include "stream.hpp"
+#include "batch.hpp"
+#include "lazy.hpp"
+#include "export.hpp"
+#include "cache.hpp"
 #include "gui.hpp"
+#include "spectrogram.hpp"
 #include "handler.hpp"
 
 using namespace std;
 
+// Size of the spectrogram renders saved in headless mode
+const pair<int, int> HEADLESS_IMAGE_SIZE(2048, 1024);
+
+// The GUI selects window sizes with the number keys
+const size_t MAX_WINDOW_SIZES = 9;
+
 struct config_t {
-    config_t() : window_size(1024),
-                 hamming(false),
+    config_t() : window_sizes{1024},
+                 window{wavalyzer::WINDOW_HANN, 0.0f},
                  min_freq(100),
                  max_freq(2000),
                  freq_step(10),
                  ms_step(1),
                  buckets(15),
+                 kernel("auto"),
+                 engine("fft"),
+                 threads(wavalyzer::get_hardware_threads()),
+                 output(""),
+                 headless(""),
+                 save_png(false),
+                 save_pdf(false),
+                 cache(true),
+                 cache_size(1024),
+                 batch(""),
+                 adaptive(false),
+                 storage{true, wavalyzer::SPECTROGRAM_FLOAT32, 0},
                  filename("")
 
     {
     }
 
-    size_t window_size;
-    bool hamming;
+    vector<size_t> window_sizes;
+    wavalyzer::window_t window;
     size_t min_freq;
     size_t max_freq;
     size_t freq_step;
     size_t ms_step;
     size_t buckets;
+    string kernel;
+    string engine;
+    size_t threads;
+    string output;
+    string headless;
+    bool save_png;
+    bool save_pdf;
+    bool cache;
+    size_t cache_size;
+    string batch;
+    bool adaptive;
+    wavalyzer::spectrogram_storage_t storage;
+    vector<string> inputs;
     string filename;
 };
 
+// The spectra of one of the window sizes, and how its windows are laid out
+struct resolution_t {
+    wavalyzer::analysis_config_t analysis_config;
+    wavalyzer::window_layout_t layout;
+    uint64_t cache_key, cached_content_hash;
+    bool cached;
+    wavalyzer::spectrogram_matrix spectra;
+    unique_ptr<ofstream> output_file;
+    unique_ptr<wavalyzer::spectrum_sink> output;
+};
+
+// Passes the spectra on while reporting how far the analysis has come
+class progress_sink : public wavalyzer::spectrum_sink {
+private:
+    wavalyzer::spectrum_sink& sink;
+    size_t window_count, report_interval;
+    int ms_step;
+    float analyzed_ms;
+
+    // Reports once for every report_interval windows passed, and at the end
+    void report(size_t first, size_t done) {
+        if (done / report_interval != first / report_interval || done == window_count) {
+            cout << fixed << "[|] Analyzed " <<
+                static_cast<int>(done) * ms_step << "ms of " << analyzed_ms << "ms ("
+                << setprecision(2) << static_cast<float>(100 * done) / window_count << " %)" << endl;
+        }
+    }
+
+public:
+    progress_sink(wavalyzer::spectrum_sink& _sink, size_t _report_interval, int _ms_step, float _analyzed_ms)
+        : sink(_sink),
+          window_count(0),
+          report_interval(_report_interval),
+          ms_step(_ms_step),
+          analyzed_ms(_analyzed_ms) {}
+
+    void begin(size_t _window_count, size_t bucket_count) {
+        window_count = _window_count;
+        sink.begin(window_count, bucket_count);
+    }
+
+    void write(size_t index, const float* buckets) {
+        sink.write(index, buckets);
+        report(index, index + 1);
+    }
+
+    void write_block(size_t first, size_t count, size_t bucket_count, const float* buckets) {
+        sink.write_block(first, count, bucket_count, buckets);
+        report(first, first + count);
+    }
+
+    void end() {
+        sink.end();
+    }
+};
+
+// Sets a flag when it goes out of scope, however that happens
+class set_on_exit {
+private:
+    atomic<bool>& flag;
+
+public:
+    set_on_exit(atomic<bool>& _flag)
+        : flag(_flag) {}
+
+    ~set_on_exit() {
+        flag = true;
+    }
+};
+
 size_t as_number(const string& s)
 {
     size_t n = 0;
@@ -51,24 +170,205 @@ size_t as_number(const string& s)
     return n;
 }
 
+// With several window sizes, every one gets files of its own
+string get_output_name(const string& name, size_t window_size, bool several)
+{
+    return several ? name + "." + to_string(window_size) : name;
+}
+
+// The window and its gains at the first window size, which barely differ
+// at the others
+string describe_window(const config_t& conf)
+{
+    const wavalyzer::window_table_t& table = wavalyzer::get_window(conf.window, conf.window_sizes[0]);
+
+    ostringstream description;
+    description << wavalyzer::get_window_name(conf.window) << fixed << setprecision(3) <<
+                   " (coherent gain " << table.coherent_gain << ", ENBW " << table.enbw << " bins)";
+
+    return description.str();
+}
+
+// Writes what headless mode saves for one window size. Only says so with
+// `verbose`, as batch mode would say it for every file.
+void save_results(const config_t& conf,
+                  const wavalyzer::spectrogram_matrix& spectra,
+                  const wavalyzer::window_layout_t& window_layout,
+                  const string& prefix,
+                  bool verbose)
+{
+    wavalyzer::spectrogram_layout_t layout;
+    layout.first_ms = window_layout.first_ms;
+    layout.step_ms = conf.ms_step;
+    layout.min_hertz = conf.min_freq;
+    layout.step_hertz = conf.freq_step;
+
+    wavalyzer::save_spectrogram_matrix(spectra, layout, prefix + ".spectrogram");
+    if (verbose) {
+        cout << "[|] Spectrogram written to `" << prefix << ".spectrogram`." << endl;
+    }
+
+    wavalyzer::save_spectrogram_peaks(spectra, layout, prefix + ".peaks.tsv");
+    if (verbose) {
+        cout << "[|] Peaks written to `" << prefix << ".peaks.tsv`." << endl;
+    }
+
+    if (conf.save_png || conf.save_pdf) {
+        // Rendered without a window, so no graphics context or font
+        wavalyzer::gui::spectrogram spect(spectra, conf.ms_step, conf.min_freq, conf.max_freq, conf.freq_step);
+        spect.set_x_range(spect.get_full_x_range());
+
+        if (conf.save_png) {
+            string filename = prefix + ".png";
+            if (!spect.render_image(HEADLESS_IMAGE_SIZE).saveToFile(filename)) {
+                throw runtime_error("Could not save `" + filename + "`");
+            }
+
+            if (verbose) {
+                cout << "[|] Spectrogram rendered to `" << filename << "`." << endl;
+            }
+        }
+
+        if (conf.save_pdf) {
+            string filename = prefix + ".pdf";
+            wavalyzer::gui::sfml_pdf pdf;
+            pdf.draw_diagram(&spect, true);
+            pdf.save_to_file(filename);
+
+            if (verbose) {
+                cout << "[|] Spectrogram rendered to `" << filename << "`." << endl;
+            }
+        }
+    }
+}
+
+// Turns the inputs of batch mode into file names: a name that contains
+// wildcards is matched against the files there are, and @list stands for
+// the names in `list`, one per line, or in the standard input for @-
+vector<string> expand_inputs(const vector<string>& inputs)
+{
+    vector<string> filenames;
+
+    for (const string& input : inputs) {
+        if (input.size() > 1 && input[0] == '@') {
+            string list_name = input.substr(1), line;
+            ifstream list_file;
+            if (list_name != "-") {
+                list_file.open(list_name);
+                if (!list_file) {
+                    throw runtime_error("Could not open the file list `" + list_name + "`");
+                }
+            }
+
+            istream& list = list_name == "-" ? cin : list_file;
+            while (getline(list, line)) {
+                if (!line.empty()) {
+                    filenames.push_back(line);
+                }
+            }
+        } else if (input.find_first_of("*?[") != string::npos) {
+            glob_t matches;
+            if (glob(input.c_str(), 0, nullptr, &matches) == 0) {
+                filenames.insert(filenames.end(), matches.gl_pathv, matches.gl_pathv + matches.gl_pathc);
+            }
+
+            globfree(&matches);
+        } else {
+            filenames.push_back(input);
+        }
+    }
+
+    return filenames;
+}
+
+// The results of a file go to the batch directory, named after the file
+// without its directory or .wav extension
+string get_batch_prefix(const string& directory, const string& filename)
+{
+    string name = filename.substr(filename.rfind('/') + 1);
+    if (name.size() > 4 && name.compare(name.size() - 4, 4, ".wav") == 0) {
+        name.resize(name.size() - 4);
+    }
+
+    return directory + "/" + name;
+}
+
+int run_batch(const config_t& conf)
+{
+    vector<string> filenames = expand_inputs(conf.inputs);
+    if (filenames.empty()) {
+        cerr << "[-] No input files." << endl;
+        return -1;
+    }
+
+    // Results would overwrite each other
+    set<string> prefixes;
+    for (const string& filename : filenames) {
+        if (!prefixes.insert(get_batch_prefix(conf.batch, filename)).second) {
+            cerr << "[-] More than one input is named like `" << filename << "`." << endl;
+            return -1;
+        }
+    }
+
+    if (mkdir(conf.batch.c_str(), 0755) != 0 && errno != EEXIST) {
+        throw runtime_error("Could not create `" + conf.batch + "`");
+    }
+
+    vector<wavalyzer::analysis_config_t> analysis_configs;
+    for (size_t window_size : conf.window_sizes) {
+        analysis_configs.push_back({0, window_size, conf.window, conf.min_freq, conf.max_freq, conf.freq_step});
+    }
+
+    wavalyzer::batch_analyzer analyzer(conf.engine, analysis_configs, conf.ms_step, conf.storage, conf.threads);
+    bool several = conf.window_sizes.size() > 1;
+    mutex console;
+
+    cout << "[|] FFT kernel: " << wavalyzer::get_fft_kernels().name << endl <<
+            "[|] Window: " << describe_window(conf) << endl <<
+            "[|] Analysis engine: " << conf.engine << endl <<
+            "[|] Threads: " << conf.threads << endl <<
+            "[+] Analyzing " << filenames.size() << " files. This may take a while." << endl;
+
+    wavalyzer::batch_stats_t stats = analyzer.run(filenames,
+        [&](const string& filename,
+            const vector<wavalyzer::spectrogram_matrix>& spectra,
+            const vector<wavalyzer::window_layout_t>& layouts) {
+
+            string prefix = get_batch_prefix(conf.batch, filename);
+            for (size_t i = 0; i < spectra.size(); i++) {
+                save_results(conf, spectra[i], layouts[i], get_output_name(prefix, conf.window_sizes[i], several), false);
+            }
+        },
+        [&](const string& filename, const exception& e) {
+            lock_guard<mutex> guard(console);
+            cerr << "[-] `" << filename << "`: " << e.what() << endl;
+        });
+
+    cout << fixed << setprecision(2) << "[+] Analyzed " << stats.files << " of " << filenames.size() <<
+            " files in " << stats.seconds << "s (" <<
+            (stats.seconds > 0 ? stats.files / stats.seconds : 0.0) << " files/s, " <<
+            (stats.seconds > 0 ? stats.samples / stats.seconds : 0.0) << " samples/s, " <<
+            (stats.seconds > 0 ? stats.windows / stats.seconds : 0.0) << " windows/s)" << endl <<
+            "[|] Results written to `" << conf.batch << "`." << endl;
+
+    return stats.failed_files == 0 ? 0 : -1;
+}
+
 bool config_validate(const config_t& c)
 {
-    switch (c.window_size) {
-    case (1 << 7):
-    case (1 << 8):
-    case (1 << 9):
-    case (1 << 10):
-    case (1 << 11):
-    case (1 << 12):
-    case (1 << 13):
-    case (1 << 14):
-        break;
-
-    default:
-        cerr << "Window size must be a power of two between 128 and 16384." << endl;
+    if (c.window_sizes.size() > MAX_WINDOW_SIZES) {
+        cerr << "At most " << MAX_WINDOW_SIZES << " window sizes can be analyzed at once." << endl;
         return false;
     }
 
+    // Any size works, but ones made of the factors 2, 3 and 5 are fastest
+    for (size_t window_size : c.window_sizes) {
+        if (window_size < 128 || window_size > 16384) {
+            cerr << "Window size must be between 128 and 16384." << endl;
+            return false;
+        }
+    }
+
     if (c.ms_step <= 0 || c.ms_step > 1000) {
         cerr << "Time step must be between 1ms and 1000ms." << endl;
         return false;
@@ -94,6 +394,41 @@ bool config_validate(const config_t& c)
         return false;
     }
 
+    if (c.threads <= 0 || c.threads > 256) {
+        cerr << "Thread count must be between 1 and 256." << endl;
+        return false;
+    }
+
+    if (!c.output.empty() + !c.headless.empty() + !c.batch.empty() > 1) {
+        cerr << "Use only one of -o, --headless and --batch." << endl;
+        return false;
+    }
+
+    if (c.engine == "sliding" && wavalyzer::get_window_cosine_terms(c.window).empty()) {
+        cerr << "The sliding engine cannot apply a " << wavalyzer::get_window_name(c.window) << " window." << endl;
+        return false;
+    }
+
+    if (c.cache_size <= 0 || c.cache_size > (1 << 20)) {
+        cerr << "Cache size must be between 1MB and 1TB." << endl;
+        return false;
+    }
+
+    if (!c.storage.automatic && c.storage.memory_budget > 0) {
+        cerr << "Use only one of --storage and --mem-budget." << endl;
+        return false;
+    }
+
+    if (c.adaptive && (!c.output.empty() || !c.headless.empty() || !c.batch.empty())) {
+        cerr << "The adaptive hop only works in the GUI." << endl;
+        return false;
+    }
+
+    if ((c.save_png || c.save_pdf) && c.headless.empty() && c.batch.empty()) {
+        cerr << "PNG and PDF renders are only saved in headless and batch mode." << endl;
+        return false;
+    }
+
     return true;
 }
 
@@ -107,30 +442,96 @@ bool arg_parse(int argc, char* argv[], config_t& res)
             continue;
         }
 
-        if (option[0] == '-') {
+        if (option.size() > 2 && option[0] == '-' && option[1] == '-') {
+            if (i >= argc - 1) {
+                cout << "Option syntax error on argument " << i << endl;
+                return false;
+            }
+
+            if (option == "--headless") {
+                if (i >= argc - 2) {
+                    cout << "Option syntax error on argument " << i << endl;
+                    return false;
+                }
+
+                res.headless = argv[++i];
+            } else if (option == "--batch") {
+                if (i >= argc - 2) {
+                    cout << "Option syntax error on argument " << i << endl;
+                    return false;
+                }
+
+                res.batch = argv[++i];
+            } else if (option == "--png") {
+                res.save_png = true;
+            } else if (option == "--pdf") {
+                res.save_pdf = true;
+            } else if (option == "--adaptive") {
+                res.adaptive = true;
+            } else if (option == "--no-cache") {
+                res.cache = false;
+            } else if (option == "--cache-size") {
+                if (i >= argc - 2) {
+                    cout << "Option syntax error on argument " << i << endl;
+                    return false;
+                }
+
+                res.cache_size = as_number(argv[++i]);
+            } else if (option == "--mem-budget") {
+                if (i >= argc - 2) {
+                    cout << "Option syntax error on argument " << i << endl;
+                    return false;
+                }
+
+                res.storage.memory_budget = static_cast<uint64_t>(as_number(argv[++i])) << 20;
+            } else if (option == "--storage") {
+                if (i >= argc - 2) {
+                    cout << "Option syntax error on argument " << i << endl;
+                    return false;
+                }
+
+                string format = argv[++i];
+                res.storage.automatic = format == "auto";
+
+                if (!res.storage.automatic && !wavalyzer::parse_spectrogram_format(format, res.storage.format)) {
+                    cerr << "Unknown storage format `" << format << "`." << endl;
+                    return false;
+                }
+            } else {
+                cerr << "Invalid option " << option << endl;
+                return false;
+            }
+        } else if (option[0] == '-') {
             if (option.size() != 2 || i >= argc - 2) {
                 cout << "Option syntax error on argument " << i << endl;
                 return false;
             }
 
-            string next = argv[i + 1], window_type;
-            size_t colon_index, hyphen_index;
+            string next = argv[i + 1], window_type, sizes;
+            size_t colon_index, hyphen_index, comma_index;
             switch (option[1]) {
             case 'w':
                 colon_index = next.find(':');
+                sizes = next.substr(0, colon_index);
+                res.window_sizes.clear();
+
+                for (size_t first = 0; ; first = comma_index + 1) {
+                    comma_index = sizes.find(',', first);
+                    res.window_sizes.push_back(as_number(sizes.substr(first, comma_index - first)));
+
+                    if (comma_index == string::npos) {
+                        break;
+                    }
+                }
+
                 if (colon_index != string::npos) {
-                    res.window_size = as_number(next.substr(0, colon_index));
                     window_type = next.substr(colon_index + 1);
-                    if (window_type == "hamming") {
-                        res.hamming = true;
-                    } else if (window_type == "hann") {
-                        res.hamming = false;
-                    } else {
-                        cerr << "Unknown window type." << endl;
+                    try {
+                        res.window = wavalyzer::parse_window(window_type);
+                    } catch (wavalyzer::window_exception& e) {
+                        cerr << e.what() << "." << endl;
                         return false;
                     }
-                } else {
-                    res.window_size = as_number(next);
                 }
 
                 break;
@@ -150,10 +551,18 @@ bool arg_parse(int argc, char* argv[], config_t& res)
             case 'r': res.freq_step = as_number(next); break;
             case 't': res.ms_step = as_number(next); break;
             case 'b': res.buckets = as_number(next); break;
+            case 'k': res.kernel = next; break;
+            case 'e': res.engine = next; break;
+            case 'j': res.threads = as_number(next); break;
+            case 'o': res.output = next; break;
             default: cerr << "Invalid option " << option << endl; return false;
             }
 
             i++;
+        } else if (!res.batch.empty()) {
+            // The options of batch mode come before all of its inputs
+            res.inputs.push_back(option);
+            got_filename = true;
         } else {
             if (i != argc - 1) {
                 cerr << "Extra parameters after filename." << endl;
@@ -183,33 +592,101 @@ int main(int argc, char* argv[])
 
     if (bad_command_line) {
         cerr << "Usage: " << argv[0] << " [options] <wavfile>" << endl <<
+                "       " << argv[0] << " [options] --batch directory <wavfile|glob|@list>..." << endl <<
                 endl <<
                 "Valid options are:" << endl <<
-                "    -w size[:hamming|hann]   Window size and type." << endl <<
+                "    -w size[,size...][:type]" << endl <<
+                "                             Window sizes and type. Several sizes are" << endl <<
+                "                             analyzed in one pass; press Tab in the GUI" << endl <<
+                "                             to switch between them. Types:" << endl <<
+                "                            ";
+
+        for (const string& name : wavalyzer::get_window_names()) {
+            cerr << " " << name;
+        }
+
+        cerr << endl <<
+                "                             (default: hann). Kaiser takes an optional" << endl <<
+                "                             beta, as in kaiser:6 (default: 8.6). The" << endl <<
+                "                             sliding engine needs a cosine sum, so it" << endl <<
+                "                             cannot use Kaiser." << endl <<
                 "    -f min-max               Frequency range (both in Hz)." << endl <<
                 "    -r resolution            Frequency resolution (in Hz)." << endl <<
                 "    -t resolution            Time resolution (in ms)." << endl <<
-                "    -b buckets               Number of histogram buckets." << endl;
+                "    -b buckets               Number of histogram buckets." << endl <<
+                "    -k kernel                FFT kernel (auto, or one of:";
+
+        for (const string& name : wavalyzer::get_fft_kernel_names()) {
+            cerr << " " << name;
+        }
+
+        cerr << ")." << endl <<
+                "    -j threads               Analysis threads (default: one per core)." << endl <<
+                "    -o file                  Write the spectra to a file instead of" << endl <<
+                "                             showing them, without keeping them all" << endl <<
+                "                             in memory. With several window sizes," << endl <<
+                "                             to file.size for every size, and the" << endl <<
+                "                             same goes for the --headless prefix." << endl <<
+                "    --headless prefix        Do not open the GUI. Write the spectrogram" << endl <<
+                "                             matrix to prefix.spectrogram and the loudest" << endl <<
+                "                             frequency of every window to prefix.peaks.tsv." << endl <<
+                "    --png                    In headless mode, also render prefix.png." << endl <<
+                "    --pdf                    In headless mode, also render prefix.pdf." << endl <<
+                "    --batch directory        Analyze many files, each on one thread, and" << endl <<
+                "                             save what headless mode does for every one" << endl <<
+                "                             to directory/name, after the file name" << endl <<
+                "                             without .wav. Inputs are files, patterns" << endl <<
+                "                             such as 'clips/*.wav', or @list to read" << endl <<
+                "                             the names from a file (@- for stdin)." << endl <<
+                "    --adaptive               In the GUI, first analyze about one window" << endl <<
+                "                             per column of the view, and the others only" << endl <<
+                "                             once zoomed in to them. Spectra are cached" << endl <<
+                "                             only if they end up analyzed in full." << endl <<
+                "    --no-cache               Always analyze, and do not save the results" << endl <<
+                "                             to the cache in ~/.cache/wavalyzer." << endl <<
+                "    --cache-size MB          Cache size limit (default: 1024)." << endl <<
+                "    --mem-budget MB          Store the spectra as float32, int16 or uint8" << endl <<
+                "                             dB, whichever is most precise and fits. In" << endl <<
+                "                             batch mode, every thread gets a share." << endl <<
+                "    --storage format         Store the spectra as one of:";
+
+        for (const string& name : wavalyzer::get_spectrogram_format_names()) {
+            cerr << " " << name;
+        }
+
+        cerr << endl <<
+                "                             (default: auto, for --mem-budget)." << endl <<
+                "    -e engine                Analysis engine (one of:";
+
+        for (const string& name : wavalyzer::get_analysis_engine_names()) {
+            cerr << " " << name;
+        }
+
+        cerr << ")." << endl;
 
         return -1;
     }
 
     try {
-        ifstream f(conf.filename);
-        wavalyzer::wav_file w(f);
+        wavalyzer::select_fft_kernels(conf.kernel);
+
+        if (!conf.batch.empty()) {
+            return run_batch(conf);
+        }
+
+        wavalyzer::wav_file w(conf.filename);
 
         cout << "[+] File `" << conf.filename << "` loaded!" << endl <<
                 "[|] Channels: " << w.get_channels() << endl <<
                 "[|] Total samples: " << w.get_total_samples() << endl <<
-                "[|] Sample rate: " << w.get_sample_rate() << endl;
+                "[|] Sample rate: " << w.get_sample_rate() << endl <<
+                "[|] Sample format: " << wavalyzer::get_sample_format_name(w.get_sample_format()) << endl <<
+                "[|] FFT kernel: " << wavalyzer::get_fft_kernels().name << endl <<
+                "[|] Window: " << describe_window(conf) << endl;
 
-        vector<float> samples;
-        w.read_samples(samples, w.get_total_samples());
         float ms_samples = w.get_sample_rate() / 1000.0f;
         int total_ms = w.get_total_samples() / ms_samples;
 
-        vector<wavalyzer::fft_result_t> ffts;
-        int window_size = static_cast<int>(conf.window_size);
         int min_freq = static_cast<int>(conf.min_freq);
         int max_freq = static_cast<int>(conf.max_freq);
         int freq_step = static_cast<int>(conf.freq_step);
@@ -220,52 +697,273 @@ int main(int argc, char* argv[])
         // Prevent a SIGFPE if the input file is short enough to make this 0
         if (report_ms_interval == 0)
             report_ms_interval = 1;
-        float ms_per_window = window_size / ms_samples;
 
-        cout << "[+] Analyzing. This may take a while.\n";
+        // Spectra streamed to a file are never kept, so there is nothing
+        // to cache
+        string cache_directory = wavalyzer::analysis_cache::get_default_directory();
+        bool use_cache = conf.cache && conf.output.empty() && !cache_directory.empty();
+        bool several = conf.window_sizes.size() > 1;
+        wavalyzer::analysis_cache cache(cache_directory, static_cast<uint64_t>(conf.cache_size) << 20);
+
+        // The cache is only a shortcut, so a file it cannot tell apart is
+        // analyzed as if it were off
+        uint64_t content_identity = 0;
+        if (use_cache) {
+            try {
+                content_identity = wavalyzer::get_content_identity(w);
+            } catch (wavalyzer::cache_exception& e) {
+                cerr << "[-] Not using the cache: " << e.what() << endl;
+                use_cache = false;
+            }
+        }
+
+        vector<unique_ptr<resolution_t>> resolutions;
+        for (size_t window_size : conf.window_sizes) {
+            resolutions.emplace_back(new resolution_t());
+            resolution_t& r = *resolutions.back();
+
+            r.analysis_config.sample_rate = w.get_sample_rate();
+            r.analysis_config.window_size = window_size;
+            r.analysis_config.window = conf.window;
+            r.analysis_config.min_hertz = conf.min_freq;
+            r.analysis_config.max_hertz = conf.max_freq;
+            r.analysis_config.step_hertz = conf.freq_step;
 
-        float gain_compensation = conf.hamming ? 1.0f / wavalyzer::get_hamming_window_gain() :
-                                                   1.0f / wavalyzer::get_hann_window_gain();
+            r.layout = wavalyzer::get_window_layout(w.get_sample_rate(), w.get_total_samples(), window_size, conf.ms_step);
 
-        vector<float> window_samples(window_size);
+            r.cache_key = 0;
+            r.cached_content_hash = 0;
+            r.cached = false;
+        }
+
+        // All window sizes share one format, picked for all of their spectra
+        size_t bucket_count = wavalyzer::get_bucket_count(conf.freq_step, conf.min_freq, conf.max_freq);
+        uint64_t value_count = 0;
+        for (auto& r : resolutions) {
+            value_count += static_cast<uint64_t>(r->layout.window_count) * bucket_count;
+        }
+
+        wavalyzer::spectrogram_format_t format = wavalyzer::choose_spectrogram_format(conf.storage, value_count);
+        uint64_t storage_bytes = value_count * wavalyzer::get_spectrogram_format_size(format);
+
+        if (conf.output.empty()) {
+            cout << fixed << setprecision(2) << "[|] Storage: " << wavalyzer::get_spectrogram_format_name(format) <<
+                    " (" << storage_bytes / 1048576.0 << "MB)" << endl;
+
+            if (conf.storage.memory_budget > 0 && storage_bytes > conf.storage.memory_budget) {
+                cerr << "[-] The spectra do not fit the memory budget even so." << endl;
+            }
+        }
+
+        for (auto& r : resolutions) {
+            r->spectra.set_format(format);
 
-        for (int i = ceil(ms_per_window / 2), counter = 0;
-             i < floor(total_ms - ms_per_window / 2);
-             i += ms_step, counter++) {
+            if (use_cache) {
+                r->cache_key = wavalyzer::get_analysis_cache_key(content_identity, r->analysis_config,
+                                                                 conf.engine, conf.ms_step);
 
-            int left_sample = (i - ms_per_window / 2) * ms_samples;
-            int right_sample = (i + ms_per_window / 2) * ms_samples;
+                r->cached = cache.load(r->cache_key, r->spectra, r->cached_content_hash) &&
+                            r->spectra.get_window_count() == r->layout.window_count &&
+                            r->spectra.get_bucket_count() == bucket_count;
+            }
+        }
 
-            for (int j = left_sample, sample = 0; j < right_sample; j++, sample++) {
-                if (sample < 0 || sample >= window_size) {
-                    break;
+        // Every sample of the file is hashed in the background, for new cache
+        // entries and to check the hits against. Those are used right away,
+        // and removed from the cache if they turn out to be of other samples
+        // that only look the same to get_content_identity, so nothing on the
+        // way to the GUI waits for the hash.
+        atomic<bool> stop_hashing(false);
+        future<uint64_t> content_hash;
+
+        // Declared after the future, so that it stops the hash before the
+        // future waits for it, on errors too
+        set_on_exit hashing_guard(stop_hashing);
+        if (use_cache) {
+            vector<resolution_t*> hits;
+            for (auto& r : resolutions) {
+                if (r->cached) {
+                    hits.push_back(r.get());
                 }
+            }
 
-                window_samples[sample] = samples[j];
+            content_hash = async(launch::async, [&conf, &w, &cache, &stop_hashing, hits]() {
+                uint64_t hash = wavalyzer::hash_pcm_contents(w.get_pcm(), stop_hashing);
+                for (resolution_t* r : hits) {
+                    if (r->cached_content_hash != hash) {
+                        cache.remove(r->cache_key);
+                        cerr << "[-] The cached analysis of " << r->analysis_config.window_size <<
+                                "-sample windows was of other samples than those of `" << conf.filename <<
+                                "`, and was removed." << endl;
+                    }
+                }
+
+                return hash;
+            });
+        }
+
+        uint64_t file_hash = 0;
+        bool hashed = false;
+        auto wait_for_hash = [&]() {
+            if (use_cache && !hashed) {
+                try {
+                    file_hash = content_hash.get();
+                    hashed = true;
+                } catch (wavalyzer::cache_exception& e) {
+                    cerr << "[-] Not saving to the cache: " << e.what() << endl;
+                    use_cache = false;
+                }
+            }
+
+            return hashed;
+        };
+
+        // Only the window sizes missing from the cache are analyzed, all in
+        // one pass over the file. The GUI opens right away instead, and
+        // shows them as they are analyzed in the background. Without it,
+        // hits are checked before they are used.
+        bool in_background = conf.output.empty() && conf.headless.empty();
+        if (!in_background) {
+            for (auto& r : resolutions) {
+                if (r->cached && wait_for_hash() && r->cached_content_hash != file_hash) {
+                    r->cached = false;
+                }
             }
+        }
 
-            if (conf.hamming) {
-                wavalyzer::apply_hamming_window(window_samples);
+        vector<resolution_t*> missing;
+        for (auto& r : resolutions) {
+            if (r->cached) {
+                cout << "[+] Analysis of " << r->analysis_config.window_size << "-sample windows loaded from the cache in `" <<
+                        cache_directory << "`." << endl;
             } else {
-                wavalyzer::apply_hann_window(window_samples);
+                missing.push_back(r.get());
+            }
+        }
+
+        vector<wavalyzer::analysis_config_t> analysis_configs;
+        for (resolution_t* r : missing) {
+            analysis_configs.push_back(r->analysis_config);
+        }
+
+        auto make_window_start = [](const resolution_t& r) {
+            return [layout = r.layout](size_t index) {
+                return layout.get_window_start(index);
+            };
+        };
+
+        if (!missing.empty() && !in_background) {
+            wavalyzer::stream_analyzer analyzer(conf.engine, analysis_configs, conf.threads);
+
+            cout << "[|] Analysis engine: " << conf.engine << endl <<
+                    "[|] Threads: " << conf.threads << endl <<
+                    "[+] Analyzing. This may take a while.\n";
+
+            vector<wavalyzer::stream_analyzer::output_t> outputs;
+            size_t window_count = 0;
+
+            for (resolution_t* r : missing) {
+                if (!conf.output.empty()) {
+                    string filename = get_output_name(conf.output, r->analysis_config.window_size, several);
+                    r->output_file.reset(new ofstream(filename));
+                    if (!*r->output_file) {
+                        throw runtime_error("Could not open `" + filename + "` for writing");
+                    }
+
+                    r->output.reset(new wavalyzer::file_sink(*r->output_file, r->layout.first_ms, ms_step, min_freq, freq_step));
+                } else {
+                    r->output.reset(new wavalyzer::matrix_sink(r->spectra));
+                }
+
+                outputs.push_back({r->layout.window_count, make_window_start(*r), r->output.get()});
+                window_count += r->layout.window_count;
+            }
+
+            // All window sizes advance together, so the first tells how far
+            // the analysis has come
+            progress_sink progress(*outputs[0].sink, report_ms_interval, ms_step, total_ms - missing[0]->layout.ms_per_window);
+            outputs[0].sink = &progress;
+
+            auto analysis_start = chrono::steady_clock::now();
+            analyzer.run(w, outputs);
+            double analysis_seconds = chrono::duration<double>(chrono::steady_clock::now() - analysis_start).count();
+
+            cout << fixed << setprecision(2) << "[+] Analysis took " << analysis_seconds << "s (" <<
+                    (analysis_seconds > 0 ? window_count / analysis_seconds : 0.0) << " windows/s)" << endl;
+
+            // Whichever stage waits least is the one holding up the others
+            for (const wavalyzer::stage_stats_t& stage : analyzer.get_stage_stats()) {
+                cout << fixed << setprecision(2) << "[|] Stage " << stage.name << " (" << stage.threads <<
+                        (stage.threads == 1 ? " thread): " : " threads): ") << stage.windows << " windows, " <<
+                        stage.busy_seconds << "s busy (" <<
+                        (stage.busy_seconds > 0 ? stage.windows / stage.busy_seconds : 0.0) << " windows/s), " <<
+                        stage.waiting_seconds << "s waiting" << endl;
+            }
+
+            for (size_t i = 0; i < missing.size() && wait_for_hash(); i++) {
+                try {
+                    cache.store(missing[i]->cache_key, file_hash, missing[i]->spectra);
+                } catch (wavalyzer::cache_exception& e) {
+                    cerr << "[-] Could not save the analysis to the cache: " << e.what() << endl;
+                }
+            }
+        }
+
+        if (!conf.output.empty()) {
+            for (auto& r : resolutions) {
+                cout << "[+] Spectra written to `" <<
+                        get_output_name(conf.output, r->analysis_config.window_size, several) << "`." << endl;
+            }
+
+            return 0;
+        }
+
+        if (!conf.headless.empty()) {
+            for (auto& r : resolutions) {
+                save_results(conf, r->spectra, r->layout,
+                             get_output_name(conf.headless, r->analysis_config.window_size, several), true);
+            }
+
+            return 0;
+        }
+
+        vector<const wavalyzer::spectrogram_matrix*> spectra;
+        vector<int> window_sizes;
+        for (auto& r : resolutions) {
+            spectra.push_back(&r->spectra);
+            window_sizes.push_back(static_cast<int>(r->analysis_config.window_size));
+        }
+
+        unique_ptr<wavalyzer::lazy_analyzer> background;
+        if (!missing.empty()) {
+            background.reset(new wavalyzer::lazy_analyzer(conf.engine, analysis_configs, conf.threads));
+
+            vector<wavalyzer::lazy_analyzer::output_t> outputs;
+            for (resolution_t* r : missing) {
+                outputs.push_back({r->layout.window_count, make_window_start(*r), &r->spectra});
             }
 
-            ffts.push_back(wavalyzer::fft_from_samples(window_samples,
-                                                       w.get_sample_rate(),
-                                                       freq_step,
-                                                       min_freq,
-                                                       max_freq,
-                                                       gain_compensation));
-
-            if (counter % report_ms_interval == 0) {
-                cout << fixed << "[|] Analyzed " <<
-                    i << "ms of " << total_ms - ms_per_window << "ms ("
-                    << setprecision(2) << static_cast<float>(100 * i) / (total_ms - ms_per_window) << " %)" << endl;
+            size_t preview_columns = conf.adaptive ? wavalyzer::gui::diagram_window::get_plot_width() : 0;
+            background->start(conf.filename, outputs, preview_columns);
+
+            cout << "[|] Analysis engine: " << conf.engine << endl <<
+                    "[|] Threads: " << conf.threads << endl;
+
+            if (conf.adaptive) {
+                cout << "[+] Previewing in the background, then analyzing what is zoomed into." << endl;
+            } else {
+                cout << "[+] Analyzing in the background, the part in view first." << endl;
             }
         }
 
         wavalyzer::gui::diagram_window window(nullptr);
-        wavalyzer::gui::main_diagram_event_handler handler(ffts, min_freq, max_freq, freq_step, ms_step, buckets);
+        wavalyzer::gui::main_diagram_event_handler handler(spectra, window_sizes, min_freq, max_freq, freq_step, ms_step, buckets);
+
+        for (size_t i = 0, config = 0; i < resolutions.size(); i++) {
+            if (!resolutions[i]->cached) {
+                handler.set_source(i, background.get(), config++);
+            }
+        }
 
         cout << endl <<
                 "[+] GUI running!" << endl <<
@@ -275,12 +973,40 @@ int main(int argc, char* argv[])
                 "    histogram of that instant." << endl <<
                 "[|] When in the histogram view, press Backspace to go back to viewing" << endl <<
                 "    the spectrogram." << endl <<
+                "[|] Windows not analyzed yet show in gray, and the ones in view are" << endl <<
+                "    analyzed first." << endl <<
+                "[|] With several window sizes, press Tab or the number keys to switch" << endl <<
+                "    between them." << endl <<
                 "[|] Press the P key at any time to save a PDF of the current contents" << endl <<
                 "    of the screen. The PDFs will be saved as diagram_1.pdf," << endl <<
                 "    diagram_2.pdf, etc. in your current working directory." << endl << endl;
 
         window.set_event_handler(&handler);
         window.start();
+
+        // Only complete spectra are cached. The hash is only waited for if
+        // there are any.
+        if (background) {
+            background->stop();
+            background->wait();
+
+            bool complete = false;
+            for (size_t config = 0; config < missing.size(); config++) {
+                complete = complete || background->is_done(config);
+            }
+
+            for (size_t config = 0; config < missing.size() && complete && wait_for_hash(); config++) {
+                if (!background->is_done(config)) {
+                    continue;
+                }
+
+                try {
+                    cache.store(missing[config]->cache_key, file_hash, missing[config]->spectra);
+                } catch (wavalyzer::cache_exception& e) {
+                    cerr << "[-] Could not save the analysis to the cache: " << e.what() << endl;
+                }
+            }
+        }
     } catch (exception& e) {
         cerr << "[-] An error has occurred: " << e.what() << endl;
         return -1;
@@ -0,0 +1,115 @@
+#include "parallel.hpp"
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <vector>
+#include <exception>
+#include <algorithm>
+
+using namespace wavalyzer;
+using namespace std;
+
+namespace wavalyzer {
+    // The indices a worker has yet to run, [begin, end)
+    struct task_range_t {
+        mutex lock;
+        size_t begin, end;
+    };
+
+    bool take_task(task_range_t& range, size_t& index);
+    bool steal_tasks(vector<task_range_t>& ranges, size_t thief, size_t& index);
+}
+
+bool wavalyzer::take_task(task_range_t& range, size_t& index)
+{
+    lock_guard<mutex> guard(range.lock);
+    if (range.begin == range.end) {
+        return false;
+    }
+
+    index = range.begin++;
+    return true;
+}
+
+// Only one range is ever locked at a time, so thieves cannot deadlock
+bool wavalyzer::steal_tasks(vector<task_range_t>& ranges, size_t thief, size_t& index)
+{
+    for (size_t offset = 1; offset < ranges.size(); offset++) {
+        task_range_t& victim = ranges[(thief + offset) % ranges.size()];
+        size_t begin, end;
+
+        {
+            lock_guard<mutex> guard(victim.lock);
+            if (victim.begin == victim.end) {
+                continue;
+            }
+
+            begin = victim.begin + (victim.end - victim.begin) / 2;
+            end = victim.end;
+            victim.end = begin;
+        }
+
+        lock_guard<mutex> guard(ranges[thief].lock);
+        ranges[thief].begin = begin + 1;
+        ranges[thief].end = end;
+        index = begin;
+
+        return true;
+    }
+
+    return false;
+}
+
+void wavalyzer::parallel_for(size_t thread_count,
+                             size_t task_count,
+                             const function<void(size_t worker, size_t index)>& task)
+{
+    thread_count = max<size_t>(1, min(thread_count, task_count));
+
+    vector<task_range_t> ranges(thread_count);
+    for (size_t worker = 0; worker < thread_count; worker++) {
+        ranges[worker].begin = task_count * worker / thread_count;
+        ranges[worker].end = task_count * (worker + 1) / thread_count;
+    }
+
+    exception_ptr error;
+    mutex error_lock;
+    atomic<bool> failed(false);
+
+    auto work = [&](size_t worker) {
+        try {
+            size_t index;
+            while (!failed && (take_task(ranges[worker], index) ||
+                               steal_tasks(ranges, worker, index))) {
+                task(worker, index);
+            }
+        } catch (...) {
+            lock_guard<mutex> guard(error_lock);
+            if (!error) {
+                error = current_exception();
+            }
+
+            failed = true;
+        }
+    };
+
+    vector<thread> threads;
+    for (size_t worker = 1; worker < thread_count; worker++) {
+        threads.emplace_back(work, worker);
+    }
+
+    work(0);
+
+    for (thread& t : threads) {
+        t.join();
+    }
+
+    if (error) {
+        rethrow_exception(error);
+    }
+}
+
+size_t wavalyzer::get_hardware_threads()
+{
+    return max<size_t>(1, thread::hardware_concurrency());
+}
@@ -0,0 +1,21 @@
+#pragma once
+#include <cstddef>
+#include <functional>
+
+namespace wavalyzer {
+    // Runs task(worker, index) for every index in [0, task_count), on up to
+    // thread_count threads including the calling one. Each worker starts
+    // with an even share of the indices, in order, and when it runs out it
+    // steals the later half of whatever another worker has left. `worker` is
+    // below thread_count and only ever used by one thread at a time, so it
+    // can pick per-thread state.
+    //
+    // If a task throws, no new tasks are started and the first exception is
+    // rethrown once all threads have stopped.
+    void parallel_for(size_t thread_count,
+                      size_t task_count,
+                      const std::function<void(size_t worker, size_t index)>& task);
+
+    // The number of threads the hardware runs at once, at least 1
+    size_t get_hardware_threads();
+}
@@ -0,0 +1,165 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <chrono>
+
+// Bounded lock-free queues. Pushing to a full queue or popping from an
+// empty one fails instead of blocking, and the caller decides how to wait,
+// which is how the stages of a pipeline apply backpressure to each other.
+namespace wavalyzer {
+    const size_t QUEUE_CACHE_LINE = 64;
+
+    inline size_t queue_capacity(size_t capacity)
+    {
+        size_t result = 1;
+        while (result < capacity) {
+            result *= 2;
+        }
+
+        return result;
+    }
+
+    // One thread pushes, one thread pops
+    template<typename T>
+    class spsc_queue {
+    private:
+        std::unique_ptr<T[]> slots;
+        size_t mask;
+
+        // Items [head, tail) are in the queue
+        alignas(QUEUE_CACHE_LINE) std::atomic<size_t> head;
+        alignas(QUEUE_CACHE_LINE) std::atomic<size_t> tail;
+
+    public:
+        spsc_queue(size_t capacity)
+            : slots(new T[queue_capacity(capacity)]),
+              mask(queue_capacity(capacity) - 1),
+              head(0),
+              tail(0) {}
+
+        bool try_push(const T& item) {
+            size_t t = tail.load(std::memory_order_relaxed);
+            if (t - head.load(std::memory_order_acquire) > mask) {
+                return false;
+            }
+
+            slots[t & mask] = item;
+            tail.store(t + 1, std::memory_order_release);
+            return true;
+        }
+
+        bool try_pop(T& item) {
+            size_t h = head.load(std::memory_order_relaxed);
+            if (h == tail.load(std::memory_order_acquire)) {
+                return false;
+            }
+
+            item = slots[h & mask];
+            head.store(h + 1, std::memory_order_release);
+            return true;
+        }
+    };
+
+    // Any number of threads push and pop. Every cell carries a sequence
+    // number telling whether it is free for the push at its position or
+    // holds the item for the pop at its position.
+    template<typename T>
+    class mpmc_queue {
+    private:
+        struct cell_t {
+            std::atomic<size_t> sequence;
+            T item;
+        };
+
+        std::unique_ptr<cell_t[]> cells;
+        size_t mask;
+
+        alignas(QUEUE_CACHE_LINE) std::atomic<size_t> push_position;
+        alignas(QUEUE_CACHE_LINE) std::atomic<size_t> pop_position;
+
+    public:
+        mpmc_queue(size_t capacity)
+            : cells(new cell_t[queue_capacity(capacity)]),
+              mask(queue_capacity(capacity) - 1),
+              push_position(0),
+              pop_position(0) {
+            for (size_t i = 0; i <= mask; i++) {
+                cells[i].sequence.store(i, std::memory_order_relaxed);
+            }
+        }
+
+        bool try_push(const T& item) {
+            size_t position = push_position.load(std::memory_order_relaxed);
+            cell_t* cell;
+
+            while (true) {
+                cell = &cells[position & mask];
+                std::intptr_t difference = static_cast<std::intptr_t>(cell->sequence.load(std::memory_order_acquire)) -
+                                           static_cast<std::intptr_t>(position);
+
+                if (difference == 0) {
+                    if (push_position.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                        break;
+                    }
+                } else if (difference < 0) {
+                    return false;
+                } else {
+                    position = push_position.load(std::memory_order_relaxed);
+                }
+            }
+
+            cell->item = item;
+            cell->sequence.store(position + 1, std::memory_order_release);
+            return true;
+        }
+
+        bool try_pop(T& item) {
+            size_t position = pop_position.load(std::memory_order_relaxed);
+            cell_t* cell;
+
+            while (true) {
+                cell = &cells[position & mask];
+                std::intptr_t difference = static_cast<std::intptr_t>(cell->sequence.load(std::memory_order_acquire)) -
+                                           static_cast<std::intptr_t>(position + 1);
+
+                if (difference == 0) {
+                    if (pop_position.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                        break;
+                    }
+                } else if (difference < 0) {
+                    return false;
+                } else {
+                    position = pop_position.load(std::memory_order_relaxed);
+                }
+            }
+
+            item = cell->item;
+            cell->sequence.store(position + mask + 1, std::memory_order_release);
+            return true;
+        }
+    };
+
+    // Waits a little longer every time a queue is found full or empty:
+    // first by retrying right away, then by yielding, then by sleeping
+    class queue_backoff {
+    private:
+        size_t attempts;
+
+    public:
+        queue_backoff() : attempts(0) {}
+
+        void wait() {
+            if (attempts < 16) {
+                attempts++;
+            } else if (attempts < 32) {
+                attempts++;
+                std::this_thread::yield();
+            } else {
+                std::this_thread::sleep_for(std::chrono::microseconds(50));
+            }
+        }
+    };
+}
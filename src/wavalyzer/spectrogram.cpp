@@ -2,6 +2,7 @@
 #include "common.hpp"
 #include <iostream>
 #include <cstring>
+#include <cmath>
 
 using namespace std;
 using namespace wavalyzer::gui;
@@ -23,39 +24,31 @@ const int COLOR_STOPS[6][3] = { {  34,  34,  34 },
 const float DBFS_STOPS[] = { -80.0f, -64.0f, -48.0f, -32.0f, -16.0f, 0.0f };
 const float GAIN_DBFS = 15.0f;
 
-spectrogram::spectrogram(const std::vector<fft_result_t>& _fft_results,
+// Windows that have not been analyzed yet
+const int PENDING_COLOR[3] = { 68, 68, 68 };
+
+spectrogram::spectrogram(const spectrogram_matrix& _spectra,
                          int _step_ms,
                          float _min_hertz,
                          float _max_hertz,
-                         float _step_hertz) :
+                         float _step_hertz,
+                         const string& _title) :
 
+                         spectra(_spectra),
+                         title(_title),
                          step_ms(_step_ms),
                          min_hertz(_min_hertz),
                          max_hertz(_max_hertz),
                          step_hertz(_step_hertz),
                          left_ms(0),
-                         max_ms((_fft_results.size() - 1) * _step_ms),
-                         cached_texture(),
+                         max_ms((static_cast<int>(_spectra.get_window_count()) - 1) * _step_ms),
                          cached_texture_size(0, 0),
-                         cached_texture_dirty(true)
+                         cached_texture_dirty(true),
+                         source(nullptr),
+                         source_config(0),
+                         source_windows_drawn(0)
 {
     right_ms = max_ms - 1;
-    sprite.setTexture(cached_texture);
-
-    // Transpose the FFT matrix to imrpove cache locality when
-    // rendering, and also convert the sample levels to dBFS to
-    // avoid expensive log() calls inside hot loops
-    size_t fft_h = _fft_results.size(),
-           fft_w = _fft_results[0].size();
-
-    fft_matrix_w = fft_h;
-
-    fft_dbfs = new float[fft_w * fft_h];
-    for (size_t i = 0; i < fft_h; i++) {
-        for (size_t j = 0; j < fft_w; j++) {
-            fft_dbfs[j * fft_matrix_w + i] = sample_level_to_dbfs(_fft_results[i][j]);
-        }
-    }
 }
 
 map<float, string> spectrogram::get_y_labels()
@@ -72,14 +65,84 @@ map<float, string> spectrogram::get_y_labels()
 
 string spectrogram::get_title()
 {
-    return "Spectrogram";
+    return title;
 }
 
 string spectrogram::get_message()
 {
+    if (source != nullptr && source->has_failed()) {
+        return "Analysis failed";
+    }
+
+    if (!is_complete()) {
+        const spectrogram_matrix* preview = source->get_preview(source_config);
+        if (preview == nullptr) {
+            size_t percent = 100 * source->get_windows_done(source_config) / max<size_t>(1, spectra.get_window_count());
+            return "Analyzing... " + to_string(percent) + " %";
+        }
+
+        if (!source->is_preview_done(source_config)) {
+            size_t percent = 100 * source->get_preview_windows_done(source_config) / max<size_t>(1, preview->get_window_count());
+            return "Previewing... " + to_string(percent) + " %";
+        }
+
+        return "Refining the view...";
+    }
+
     return "Click on a slice to view histogram";
 }
 
+void spectrogram::set_source(lazy_analyzer* analyzer, size_t config)
+{
+    source = analyzer;
+    source_config = config;
+    source_windows_drawn = 0;
+    cached_texture_dirty = true;
+}
+
+const spectrogram_matrix* spectrogram::get_ready_column(int window, size_t& column)
+{
+    if (window < 0 || window >= static_cast<int>(spectra.get_window_count())) {
+        return nullptr;
+    }
+
+    column = window;
+    if (source == nullptr || source->is_ready(source_config, column)) {
+        return &spectra;
+    }
+
+    const spectrogram_matrix* preview = source->get_preview(source_config);
+    if (preview == nullptr) {
+        return nullptr;
+    }
+
+    size_t stride = source->get_preview_stride(source_config);
+    column = min((column + stride / 2) / stride, preview->get_window_count() - 1);
+
+    return source->is_preview_ready(source_config, column) ? preview : nullptr;
+}
+
+bool spectrogram::is_complete()
+{
+    return source == nullptr || source->has_failed() || source->is_done(source_config) || source->is_idle();
+}
+
+// Windows of the preview count as well, so both passes make it change
+size_t spectrogram::get_source_windows_done()
+{
+    return source->get_windows_done(source_config) + source->get_preview_windows_done(source_config);
+}
+
+bool spectrogram::has_changed()
+{
+    if (source == nullptr || get_source_windows_done() == source_windows_drawn) {
+        return false;
+    }
+
+    cached_texture_dirty = true;
+    return true;
+}
+
 pair<float, float> spectrogram::get_full_x_range()
 {
     return make_pair(0.0f, max_ms - 1.0f);
@@ -126,6 +189,10 @@ void spectrogram::set_x_range(pair<float, float> new_range)
     left_ms = new_range.first;
     right_ms = new_range.second;
     cached_texture_dirty = true;
+
+    if (source != nullptr) {
+        source->focus(source_config, max(left_ms, 0) / step_ms, max(right_ms, 0) / step_ms + 1);
+    }
 }
 
 void spectrogram::render_texture_bytes(pair<int, int> size)
@@ -138,7 +205,32 @@ void spectrogram::render_texture_bytes(pair<int, int> size)
     float hertz_px_step = static_cast<float>(max_hertz - min_hertz) / ((size.second - 1) * step_hertz),
           ms_px_step = static_cast<float>(right_ms - left_ms) / ((size.first - 1) * step_ms),
           left_ms_offset = static_cast<float>(left_ms) / step_ms;
-    int fft_w = fft_matrix_w;
+
+    // Taken before the columns are checked, so that windows finished
+    // meanwhile make the spectrogram change again
+    if (source != nullptr) {
+        source_windows_drawn = get_source_windows_done();
+    }
+
+    // The nearest window to every column of pixels
+    columns.resize(size.first);
+    column_spectra.resize(size.first);
+    for (int x = 0; x < size.first; x++) {
+        float ms_frac = left_ms_offset + x * ms_px_step;
+
+        int nn_left = static_cast<int>(floor(ms_frac)),
+            nn_right = static_cast<int>(ceil(ms_frac));
+
+        if (nn_right >= max_ms) {
+            nn_right = max_ms - 1;
+        }
+
+        if (nn_left > nn_right) {
+            nn_left = nn_right;
+        }
+
+        column_spectra[x] = get_ready_column((ms_frac - nn_left) > 0.5f ? nn_right : nn_left, columns[x]);
+    }
 
     int last_bucket = -1;
     for (int y = 0; y < size.second; y++) {
@@ -154,25 +246,10 @@ void spectrogram::render_texture_bytes(pair<int, int> size)
         }
 
         for (int x = 0; x < size.first; x++) {
-            float ms_frac = left_ms_offset + x * ms_px_step;
-
-            int nn_left = static_cast<int>(floor(ms_frac)),
-                nn_right = static_cast<int>(ceil(ms_frac));
-
-            if (nn_right >= max_ms) {
-                nn_right = max_ms - 1;
-            }
-
-            if (nn_left > nn_right) {
-                nn_left = nn_right;
-            }
-
-            float dbfs_left = fft_dbfs[bucket * fft_w + nn_left],
-                  dbfs_right = fft_dbfs[bucket * fft_w + nn_right];
-
-            float nn_value = (ms_frac - nn_left) > 0.5f ? dbfs_right : dbfs_left;
+            const spectrogram_matrix* column = column_spectra[x];
+            sf::Color nn_color = column != nullptr ? color_from_dbfs(column->get_db(bucket, columns[x])) :
+                                                     sf::Color(PENDING_COLOR[0], PENDING_COLOR[1], PENDING_COLOR[2], 255);
 
-            sf::Color nn_color = color_from_dbfs(nn_value);
             pixels[y * size.first * 4 + x * 4 + 0] = nn_color.r;
             pixels[y * size.first * 4 + x * 4 + 1] = nn_color.g;
             pixels[y * size.first * 4 + x * 4 + 2] = nn_color.b;
@@ -186,8 +263,12 @@ void spectrogram::render_texture_bytes(pair<int, int> size)
 
 void spectrogram::update_texture(pair<int, int> size)
 {
+    if (!cached_texture) {
+        cached_texture = make_unique<sf::Texture>();
+    }
+
     if (cached_texture_size != size) {
-        if (!cached_texture.create(size.first, size.second)) {
+        if (!cached_texture->create(size.first, size.second)) {
             throw gui_exception("Could not create spectrogram texture");
         }
 
@@ -195,7 +276,7 @@ void spectrogram::update_texture(pair<int, int> size)
     }
 
     render_texture_bytes(size);
-    cached_texture.update(&pixels[0]);
+    cached_texture->update(&pixels[0]);
 }
 
 sf::Color spectrogram::color_from_dbfs(float dbfs)
@@ -232,18 +313,22 @@ void spectrogram::draw(sf::RenderTarget* target, pair<int, int> bottom_left, pai
         cached_texture_dirty = false;
     }
 
-    sf::Sprite new_sprite(cached_texture);
+    sf::Sprite new_sprite(*cached_texture);
     new_sprite.setPosition(sf::Vector2f(bottom_left.first, bottom_left.second - size.second));
     target->draw(new_sprite);
 }
 
-void spectrogram::draw_to_pdf(sfml_pdf& pdf, pair<int, int> bottom_left, pair<int, int> size)
+sf::Image spectrogram::render_image(pair<int, int> size)
 {
     render_texture_bytes(size);
-    pdf.draw(&pixels[0], make_pair(bottom_left.first, bottom_left.second - size.second), size);
+
+    sf::Image image;
+    image.create(size.first, size.second, &pixels[0]);
+    return image;
 }
 
-spectrogram::~spectrogram()
+void spectrogram::draw_to_pdf(sfml_pdf& pdf, pair<int, int> bottom_left, pair<int, int> size)
 {
-    delete[] fft_dbfs;
+    render_texture_bytes(size);
+    pdf.draw(&pixels[0], make_pair(bottom_left.first, bottom_left.second - size.second), size);
 }
@@ -1,36 +1,59 @@
 #pragma once
 #include "gui.hpp"
-#include "fft.hpp"
+#include "spectrogram_matrix.hpp"
+#include "lazy.hpp"
 
 namespace wavalyzer::gui {
     class spectrogram : public diagram {
     private:
-        float* fft_dbfs;
-        int fft_matrix_w;
+        const spectrogram_matrix& spectra;
+        std::string title;
         int step_ms;
         float min_hertz, max_hertz, step_hertz;
         int left_ms, right_ms, max_ms;
-        sf::Texture cached_texture;
-        sf::Sprite sprite;
+        // Only created once the spectrogram is drawn to a window, so that
+        // rendering to an image or a PDF needs no graphics context
+        std::unique_ptr<sf::Texture> cached_texture;
         std::pair<int, int> cached_texture_size;
         std::vector<sf::Uint8> pixels;
+        // What every column of pixels shows; no spectra while pending
+        std::vector<size_t> columns;
+        std::vector<const spectrogram_matrix*> column_spectra;
         bool cached_texture_dirty;
 
+        // Set while the spectra are still being analyzed
+        lazy_analyzer* source;
+        size_t source_config, source_windows_drawn;
+
+        size_t get_source_windows_done();
         void update_texture(std::pair<int, int> size);
         void render_texture_bytes(std::pair<int, int> size);
         sf::Color color_from_dbfs(float dbfs);
 
     public:
-        spectrogram(const std::vector<fft_result_t>& _fft_results,
+        spectrogram(const spectrogram_matrix& _spectra,
                     int _step_ms,
                     float _min_hertz,
                     float _max_hertz,
-                    float _step_hertz);
+                    float _step_hertz,
+                    const std::string& _title = "Spectrogram");
 
         std::map<float, std::string> get_y_labels();
         std::string get_title();
         std::string get_message();
 
+        // Shows the windows of one config of `analyzer` as they come in,
+        // and asks for the ones in view first
+        void set_source(lazy_analyzer* analyzer, size_t config);
+
+        // The spectra and column to show for a window: the window itself
+        // once it is analyzed, or else the nearest one of the preview.
+        // Nothing while neither is ready.
+        const spectrogram_matrix* get_ready_column(int window, size_t& column);
+
+        bool is_complete();
+        bool has_changed();
+
         float get_drag_step_normalized();
         float get_zoom_granularity();
 
@@ -41,9 +64,12 @@ namespace wavalyzer::gui {
 
         void set_x_range(std::pair<float, float> new_range);
 
+        // Renders the current range without axes or labels
+        sf::Image render_image(std::pair<int, int> size);
+
         void draw(sf::RenderTarget* target, std::pair<int, int> bottom_left, std::pair<int, int> size);
         void draw_to_pdf(sfml_pdf& pdf, std::pair<int, int> bottom_left, std::pair<int, int> size);
 
-        virtual ~spectrogram();
+        virtual ~spectrogram() {}
     };
 }
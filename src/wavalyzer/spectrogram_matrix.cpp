@@ -0,0 +1,297 @@
+#include "spectrogram_matrix.hpp"
+#include "fft_kernels.hpp"
+#include <algorithm>
+#include <cmath>
+#include <new>
+
+using namespace wavalyzer;
+using namespace std;
+
+// Rows start on a cache line, so vector loads along a row never split one
+const size_t SPECTROGRAM_MATRIX_ALIGNMENT = 64;
+
+// set_columns converts a tile of up to a cache line of windows by this many
+// buckets on the stack, then writes it out one cache line per row
+const size_t SPECTROGRAM_MATRIX_TILE_BUCKETS = 64;
+const size_t SPECTROGRAM_MATRIX_MAX_TILE_WINDOWS = SPECTROGRAM_MATRIX_ALIGNMENT;
+
+namespace wavalyzer {
+    struct spectrogram_format_info_t {
+        const char* name;
+        spectrogram_format_t format;
+    };
+
+    uint16_t float_to_half(float value);
+
+    float encode_float32(float db);
+    uint16_t encode_float16(float db);
+    int16_t encode_int16(float db);
+    uint8_t encode_uint8(float db);
+
+    // Writes a tile of dB levels, TILE_BUCKETS apart per window, to the
+    // rows from `first` on
+    template<typename T, T (*Encode)(float)>
+    void store_tile(const float* tile, size_t windows, size_t buckets, unsigned char* first, size_t row_bytes);
+}
+
+const spectrogram_format_info_t SPECTROGRAM_FORMATS[] = {
+    { "float32", SPECTROGRAM_FLOAT32 },
+    { "float16", SPECTROGRAM_FLOAT16 },
+    { "int16", SPECTROGRAM_INT16 },
+    { "uint8", SPECTROGRAM_UINT8 }
+};
+
+// What an automatic choice goes through, most precise first
+const spectrogram_format_t AUTOMATIC_FORMATS[] = { SPECTROGRAM_FLOAT32, SPECTROGRAM_INT16, SPECTROGRAM_UINT8 };
+
+string wavalyzer::get_spectrogram_format_name(spectrogram_format_t format)
+{
+    for (const spectrogram_format_info_t& info : SPECTROGRAM_FORMATS) {
+        if (info.format == format) {
+            return info.name;
+        }
+    }
+
+    return "unknown";
+}
+
+vector<string> wavalyzer::get_spectrogram_format_names()
+{
+    vector<string> names;
+    for (const spectrogram_format_info_t& info : SPECTROGRAM_FORMATS) {
+        names.push_back(info.name);
+    }
+
+    return names;
+}
+
+bool wavalyzer::parse_spectrogram_format(const string& name, spectrogram_format_t& format)
+{
+    for (const spectrogram_format_info_t& info : SPECTROGRAM_FORMATS) {
+        if (name == info.name) {
+            format = info.format;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+spectrogram_format_t wavalyzer::choose_spectrogram_format(const spectrogram_storage_t& storage, uint64_t value_count)
+{
+    if (!storage.automatic) {
+        return storage.format;
+    }
+
+    for (spectrogram_format_t format : AUTOMATIC_FORMATS) {
+        if (storage.memory_budget == 0 || value_count * get_spectrogram_format_size(format) <= storage.memory_budget) {
+            return format;
+        }
+    }
+
+    return SPECTROGRAM_UINT8;
+}
+
+uint16_t wavalyzer::float_to_half(float value)
+{
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+
+    uint32_t sign = (bits >> 16) & 0x8000,
+             mantissa = bits & 0x7fffff;
+    int exponent = static_cast<int>((bits >> 23) & 0xff) - 127 + 15;
+
+    if (((bits >> 23) & 0xff) == 0xff) {
+        return sign | 0x7c00 | (mantissa != 0 ? 0x200 : 0);
+    }
+
+    if (exponent >= 31) {
+        return sign | 0x7c00;
+    }
+
+    // Rounded to nearest, ties to even. A carry out of the mantissa
+    // correctly bumps the exponent.
+    uint32_t half, rest, halfway;
+    if (exponent <= 0) {
+        if (exponent < -10) {
+            return sign;
+        }
+
+        int shift = 14 - exponent;
+        mantissa |= 0x800000;
+        half = mantissa >> shift;
+        rest = mantissa & ((1u << shift) - 1);
+        halfway = 1u << (shift - 1);
+    } else {
+        half = (static_cast<uint32_t>(exponent) << 10) | (mantissa >> 13);
+        rest = mantissa & 0x1fff;
+        halfway = 0x1000;
+    }
+
+    if (rest > halfway || (rest == halfway && (half & 1) != 0)) {
+        half++;
+    }
+
+    return sign | half;
+}
+
+float wavalyzer::encode_float32(float db)
+{
+    return db;
+}
+
+uint16_t wavalyzer::encode_float16(float db)
+{
+    return float_to_half(db);
+}
+
+int16_t wavalyzer::encode_int16(float db)
+{
+    return static_cast<int16_t>(lrint(min(max(db / SPECTROGRAM_INT16_DB_STEP, -32768.0f), 32767.0f)));
+}
+
+uint8_t wavalyzer::encode_uint8(float db)
+{
+    return static_cast<uint8_t>(lrint(min(max((db - SPECTROGRAM_UINT8_MIN_DB) / SPECTROGRAM_UINT8_DB_STEP, 0.0f),
+                                          255.0f)));
+}
+
+template<typename T, T (*Encode)(float)>
+void wavalyzer::store_tile(const float* tile, size_t windows, size_t buckets, unsigned char* first, size_t row_bytes)
+{
+    for (size_t b = 0; b < buckets; b++) {
+        T* destination = reinterpret_cast<T*>(first + b * row_bytes);
+        for (size_t w = 0; w < windows; w++) {
+            destination[w] = Encode(tile[w * SPECTROGRAM_MATRIX_TILE_BUCKETS + b]);
+        }
+    }
+}
+
+spectrogram_matrix::spectrogram_matrix()
+    : window_count(0),
+      bucket_count(0),
+      row_stride(0),
+      capacity(0),
+      format(SPECTROGRAM_FLOAT32),
+      data(nullptr)
+{
+}
+
+spectrogram_matrix::~spectrogram_matrix()
+{
+    free_storage();
+}
+
+void spectrogram_matrix::free_storage()
+{
+    if (release) {
+        release();
+        release = nullptr;
+    } else {
+        ::operator delete[](data, align_val_t(SPECTROGRAM_MATRIX_ALIGNMENT));
+    }
+
+    data = nullptr;
+    capacity = 0;
+}
+
+size_t spectrogram_matrix::get_row_stride(size_t window_count, spectrogram_format_t format)
+{
+    size_t line = SPECTROGRAM_MATRIX_ALIGNMENT / get_spectrogram_format_size(format);
+    return (window_count + line - 1) / line * line;
+}
+
+void spectrogram_matrix::resize(size_t _window_count, size_t _bucket_count)
+{
+    size_t size = get_row_stride(_window_count, format) * _bucket_count * get_spectrogram_format_size(format);
+    if (release || size > capacity) {
+        free_storage();
+
+        data = static_cast<unsigned char*>(::operator new[](size, align_val_t(SPECTROGRAM_MATRIX_ALIGNMENT)));
+        capacity = size;
+    }
+
+    window_count = _window_count;
+    bucket_count = _bucket_count;
+    row_stride = get_row_stride(window_count, format);
+}
+
+void spectrogram_matrix::attach(void* _data,
+                                size_t _window_count,
+                                size_t _bucket_count,
+                                size_t _row_stride,
+                                spectrogram_format_t _format,
+                                const function<void()>& _release)
+{
+    free_storage();
+
+    data = static_cast<unsigned char*>(_data);
+    window_count = _window_count;
+    bucket_count = _bucket_count;
+    row_stride = _row_stride;
+    format = _format;
+    release = _release;
+}
+
+void spectrogram_matrix::read_row(size_t bucket, size_t first, size_t count, float* destination) const
+{
+    size_t size = get_spectrogram_format_size(format);
+    const unsigned char* row = get_row_data(bucket) + first * size;
+
+    for (size_t w = 0; w < count; w++) {
+        destination[w] = decode_spectrogram_db(format, row + w * size);
+    }
+}
+
+void spectrogram_matrix::set_column(size_t window, const float* levels)
+{
+    set_columns(window, 1, levels);
+}
+
+void spectrogram_matrix::set_columns(size_t first, size_t count, const float* levels)
+{
+    const fft_kernels_t& kernels = get_fft_kernels();
+    float tile[SPECTROGRAM_MATRIX_MAX_TILE_WINDOWS * SPECTROGRAM_MATRIX_TILE_BUCKETS];
+
+    size_t size = get_spectrogram_format_size(format),
+           line = SPECTROGRAM_MATRIX_ALIGNMENT / size,
+           row_bytes = row_stride * size;
+
+    size_t window = first, end = first + count;
+    while (window < end) {
+        // Tiles end where cache lines of the rows do, so no two threads
+        // setting different windows write the same line at once
+        size_t windows = min(end - window, line - window % line);
+        const float* tile_levels = levels + (window - first) * bucket_count;
+
+        for (size_t bucket = 0; bucket < bucket_count; bucket += SPECTROGRAM_MATRIX_TILE_BUCKETS) {
+            size_t buckets = min(bucket_count - bucket, SPECTROGRAM_MATRIX_TILE_BUCKETS);
+
+            for (size_t w = 0; w < windows; w++) {
+                kernels.levels_to_db(tile_levels + w * bucket_count + bucket, buckets,
+                                     tile + w * SPECTROGRAM_MATRIX_TILE_BUCKETS);
+            }
+
+            unsigned char* destination = data + bucket * row_bytes + window * size;
+            switch (format) {
+            case SPECTROGRAM_FLOAT16:
+                store_tile<uint16_t, encode_float16>(tile, windows, buckets, destination, row_bytes);
+                break;
+
+            case SPECTROGRAM_INT16:
+                store_tile<int16_t, encode_int16>(tile, windows, buckets, destination, row_bytes);
+                break;
+
+            case SPECTROGRAM_UINT8:
+                store_tile<uint8_t, encode_uint8>(tile, windows, buckets, destination, row_bytes);
+                break;
+
+            default:
+                store_tile<float, encode_float32>(tile, windows, buckets, destination, row_bytes);
+                break;
+            }
+        }
+
+        window += windows;
+    }
+}
@@ -0,0 +1,216 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <functional>
+
+namespace wavalyzer {
+    // How a spectrogram_matrix stores its levels. The quantized formats
+    // clamp to their range, which reaches from well below the 16-bit noise
+    // floor to above full scale.
+    enum spectrogram_format_t {
+        SPECTROGRAM_FLOAT32,
+
+        // IEEE half precision dB
+        SPECTROGRAM_FLOAT16,
+
+        // Fixed point, in steps of 1/128 dB from -256 dB to 256 dB
+        SPECTROGRAM_INT16,
+
+        // Codes in steps of 0.5 dB from -120 dB to 7.5 dB
+        SPECTROGRAM_UINT8
+    };
+
+    // A fixed format, or the most precise of float32, int16 and uint8 whose
+    // levels fit memory_budget bytes (0 for no limit)
+    struct spectrogram_storage_t {
+        bool automatic;
+        spectrogram_format_t format;
+        std::uint64_t memory_budget;
+    };
+
+    const float SPECTROGRAM_INT16_DB_STEP = 1.0f / 128;
+    const float SPECTROGRAM_UINT8_MIN_DB = -120.0f;
+    const float SPECTROGRAM_UINT8_DB_STEP = 0.5f;
+
+    // Bytes per level
+    inline size_t get_spectrogram_format_size(spectrogram_format_t format)
+    {
+        return format == SPECTROGRAM_FLOAT32 ? 4 : format == SPECTROGRAM_UINT8 ? 1 : 2;
+    }
+
+    std::string get_spectrogram_format_name(spectrogram_format_t format);
+    std::vector<std::string> get_spectrogram_format_names();
+
+    // Returns false for an unknown name
+    bool parse_spectrogram_format(const std::string& name, spectrogram_format_t& format);
+
+    // The format to store value_count levels in, all matrices together
+    spectrogram_format_t choose_spectrogram_format(const spectrogram_storage_t& storage, std::uint64_t value_count);
+
+    inline float half_to_float(std::uint16_t half)
+    {
+        std::uint32_t sign = static_cast<std::uint32_t>(half & 0x8000) << 16,
+                      exponent = (half >> 10) & 0x1f,
+                      mantissa = half & 0x3ff,
+                      bits;
+
+        if (exponent == 0x1f) {
+            bits = sign | 0x7f800000 | (mantissa << 13);
+        } else if (exponent != 0) {
+            bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+        } else {
+            // Zero or subnormal, a multiple of 2^-24
+            float value = mantissa * (1.0f / (1 << 24));
+            return sign ? -value : value;
+        }
+
+        float value;
+        std::memcpy(&value, &bits, sizeof(value));
+        return value;
+    }
+
+    // The level in dB stored at `value`. Levels are read one at a time
+    // like this, so nothing ever converts a whole matrix.
+    inline float decode_spectrogram_db(spectrogram_format_t format, const unsigned char* value)
+    {
+        switch (format) {
+        case SPECTROGRAM_FLOAT16: {
+            std::uint16_t half;
+            std::memcpy(&half, value, sizeof(half));
+            return half_to_float(half);
+        }
+
+        case SPECTROGRAM_INT16: {
+            std::int16_t fixed;
+            std::memcpy(&fixed, value, sizeof(fixed));
+            return fixed * SPECTROGRAM_INT16_DB_STEP;
+        }
+
+        case SPECTROGRAM_UINT8:
+            return SPECTROGRAM_UINT8_MIN_DB + *value * SPECTROGRAM_UINT8_DB_STEP;
+
+        default: {
+            float db;
+            std::memcpy(&db, value, sizeof(db));
+            return db;
+        }
+        }
+    }
+
+    // One window's buckets in a spectrogram_matrix, without copying them
+    class spectrogram_column {
+    private:
+        const unsigned char* first;
+        size_t stride, count;
+        spectrogram_format_t format;
+
+    public:
+        // `stride` is in bytes
+        spectrogram_column(const unsigned char* _first, size_t _stride, size_t _count, spectrogram_format_t _format)
+            : first(_first), stride(_stride), count(_count), format(_format) {}
+
+        size_t size() const {
+            return count;
+        }
+
+        float operator[](size_t bucket) const {
+            return decode_spectrogram_db(format, first + bucket * stride);
+        }
+    };
+
+    // The bucket levels of every window of a file, in dB as
+    // fft_kernels_t::levels_to_db gives them, stored bucket-major in one
+    // aligned block: row b holds bucket b of every window, which is the
+    // order the spectrogram is rendered in. Rows are padded to a whole
+    // number of cache lines. The levels are floats unless set_format says
+    // otherwise.
+    class spectrogram_matrix {
+    private:
+        size_t window_count, bucket_count, row_stride, capacity;
+        spectrogram_format_t format;
+        unsigned char* data;
+
+        // Frees `data` when the matrix did not allocate it, as with a mapped
+        // file
+        std::function<void()> release;
+
+        void free_storage();
+
+    public:
+        spectrogram_matrix();
+        ~spectrogram_matrix();
+
+        spectrogram_matrix(const spectrogram_matrix&) = delete;
+        spectrogram_matrix& operator=(const spectrogram_matrix&) = delete;
+
+        // The format of the levels from the next resize() on
+        void set_format(spectrogram_format_t _format) {
+            format = _format;
+        }
+
+        spectrogram_format_t get_format() const {
+            return format;
+        }
+
+        // Makes room for window_count windows of bucket_count buckets,
+        // reusing the storage if it is large enough. The previous contents
+        // are lost.
+        void resize(size_t _window_count, size_t _bucket_count);
+
+        // Uses storage allocated elsewhere, laid out as get_row_stride says,
+        // instead of allocating. _release is called once the matrix no
+        // longer needs it.
+        void attach(void* _data,
+                    size_t _window_count,
+                    size_t _bucket_count,
+                    size_t _row_stride,
+                    spectrogram_format_t _format,
+                    const std::function<void()>& _release);
+
+        // Levels from the start of one row to the next, a whole number of
+        // cache lines for window_count windows
+        static size_t get_row_stride(size_t window_count, spectrogram_format_t format);
+
+        size_t get_row_stride() const {
+            return row_stride;
+        }
+
+        size_t get_window_count() const {
+            return window_count;
+        }
+
+        size_t get_bucket_count() const {
+            return bucket_count;
+        }
+
+        // Bucket `bucket` of every window, as stored
+        const unsigned char* get_row_data(size_t bucket) const {
+            return data + bucket * row_stride * get_spectrogram_format_size(format);
+        }
+
+        float get_db(size_t bucket, size_t window) const {
+            return decode_spectrogram_db(format, get_row_data(bucket) + window * get_spectrogram_format_size(format));
+        }
+
+        // Bucket `bucket` of `count` windows from `first` on, in dB
+        void read_row(size_t bucket, size_t first, size_t count, float* destination) const;
+
+        spectrogram_column get_column(size_t window) const {
+            size_t size = get_spectrogram_format_size(format);
+            return spectrogram_column(data + window * size, row_stride * size, bucket_count, format);
+        }
+
+        // Stores the bucket levels of one window, converted to dB
+        void set_column(size_t window, const float* levels);
+
+        // Stores the bucket levels of `count` windows from `first` on, one
+        // window after another as analysis_engine::analyze gives them,
+        // converted to dB. Goes a tile at a time, so that both the levels
+        // read and the rows written stay in cache. Different threads may
+        // set different windows at once.
+        void set_columns(size_t first, size_t count, const float* levels);
+    };
+}
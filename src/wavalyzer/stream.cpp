@@ -0,0 +1,569 @@
+#include "stream.hpp"
+#include <algorithm>
+#include <thread>
+#include <chrono>
+#include <cstdint>
+
+using namespace wavalyzer;
+using namespace std;
+
+// Windows per task handed to an analysis thread. Fixed, so that the split,
+// and with it the output, is the same for any number of threads.
+const size_t STREAM_TASK_WINDOWS = 512;
+
+// Tasks per block, taken from all configs. A block stops growing sooner
+// once its windows need more samples than STREAM_BLOCK_SAMPLES.
+const size_t STREAM_BLOCK_TASKS = 16;
+const size_t STREAM_BLOCK_SAMPLES = 1 << 20;
+
+// Samples decoded by one read, unless the windows stop overlapping sooner
+const size_t STREAM_READ_SAMPLES = 1 << 16;
+
+// Blocks in flight: one being read, one being analyzed and one being
+// written lets all stages run at once. Each further STREAM_BLOCK_TASKS
+// threads get one more block.
+const size_t STREAM_BLOCKS = 3;
+
+namespace wavalyzer {
+    double seconds_since(chrono::steady_clock::time_point start);
+}
+
+double wavalyzer::seconds_since(chrono::steady_clock::time_point start)
+{
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+void spectrum_sink::write_block(size_t first, size_t count, size_t bucket_count, const float* buckets)
+{
+    for (size_t w = 0; w < count; w++) {
+        write(first + w, buckets + w * bucket_count);
+    }
+}
+
+matrix_sink::matrix_sink(spectrogram_matrix& _destination)
+    : destination(_destination)
+{
+}
+
+void matrix_sink::begin(size_t window_count, size_t bucket_count)
+{
+    destination.resize(window_count, bucket_count);
+}
+
+void matrix_sink::write(size_t index, const float* buckets)
+{
+    destination.set_column(index, buckets);
+}
+
+void matrix_sink::write_block(size_t first, size_t count, size_t, const float* buckets)
+{
+    destination.set_columns(first, count, buckets);
+}
+
+file_sink::file_sink(ostream& _file,
+                     size_t _first_ms,
+                     size_t _step_ms,
+                     size_t _min_hertz,
+                     size_t _step_hertz)
+    : file(_file),
+      first_ms(_first_ms),
+      step_ms(_step_ms),
+      min_hertz(_min_hertz),
+      step_hertz(_step_hertz),
+      bucket_count(0)
+{
+}
+
+void file_sink::begin(size_t, size_t _bucket_count)
+{
+    bucket_count = _bucket_count;
+
+    file << "ms";
+    for (size_t i = 0; i < bucket_count; i++) {
+        file << '\t' << min_hertz + i * step_hertz;
+    }
+
+    file << '\n';
+}
+
+void file_sink::write(size_t index, const float* buckets)
+{
+    file << first_ms + index * step_ms;
+    for (size_t i = 0; i < bucket_count; i++) {
+        file << '\t' << buckets[i];
+    }
+
+    file << '\n';
+}
+
+void file_sink::end()
+{
+    file.flush();
+    if (!file) {
+        throw stream_exception("Could not write the spectra");
+    }
+}
+
+callback_sink::callback_sink(const callback_t& _callback)
+    : callback(_callback),
+      bucket_count(0)
+{
+}
+
+void callback_sink::begin(size_t, size_t _bucket_count)
+{
+    bucket_count = _bucket_count;
+}
+
+void callback_sink::write(size_t index, const float* buckets)
+{
+    callback(index, buckets, bucket_count);
+}
+
+stream_analyzer::stream_analyzer(const string& engine, const vector<analysis_config_t>& configs, size_t threads)
+    : thread_count(max<size_t>(1, threads)),
+      free_blocks(STREAM_BLOCKS + thread_count / STREAM_BLOCK_TASKS),
+      ready_blocks(STREAM_BLOCKS + thread_count / STREAM_BLOCK_TASKS + 1),
+      tasks((STREAM_BLOCKS + thread_count / STREAM_BLOCK_TASKS) * STREAM_BLOCK_TASKS + thread_count),
+      failed(false),
+      read_counters(),
+      write_counters(),
+      analyze_counters(thread_count),
+      offset(0)
+{
+    if (configs.empty()) {
+        throw stream_exception("Nothing to analyze");
+    }
+
+    for (const analysis_config_t& config : configs) {
+        resolution_t resolution;
+        resolution.window_size = config.window_size;
+
+        for (size_t t = 0; t < thread_count; t++) {
+            resolution.engines.push_back(make_analysis_engine(engine, config));
+        }
+
+        resolution.bucket_count = resolution.engines[0]->get_bucket_count();
+        resolutions.push_back(move(resolution));
+    }
+
+    for (size_t b = 0; b < STREAM_BLOCKS + thread_count / STREAM_BLOCK_TASKS; b++) {
+        blocks.emplace_back(new block_t());
+    }
+}
+
+stream_analyzer::stream_analyzer(const string& engine, const analysis_config_t& config, size_t threads)
+    : stream_analyzer(engine, vector<analysis_config_t>{config}, threads)
+{
+}
+
+// Picks the tasks of the next block, each the next STREAM_TASK_WINDOWS
+// windows of a config, the one whose first window starts soonest first.
+// Every config is split into tasks the same way no matter how the others
+// are, since engines may carry state between the windows of a task. Puts
+// the starts of the windows in `starts` and their order by start in
+// `order`. Returns false if all are read.
+bool stream_analyzer::plan_block(const vector<output_t>& outputs)
+{
+    size_t needed = 0;
+    for (vector<size_t>& config_starts : starts) {
+        config_starts.clear();
+    }
+
+    for (size_t tasks = 0; tasks < STREAM_BLOCK_TASKS && (tasks == 0 || needed <= STREAM_BLOCK_SAMPLES); tasks++) {
+        // Ties go to the config given first
+        size_t next = get_next_config(outputs);
+        if (next == outputs.size()) {
+            break;
+        }
+
+        size_t window_size = resolutions[next].window_size,
+               task_end = min(next_window[next] + STREAM_TASK_WINDOWS, outputs[next].window_count),
+               previous_end = 0;
+
+        while (next_window[next] < task_end) {
+            size_t start = next_start[next];
+
+            // Overlapping windows share their samples
+            needed += start >= previous_end ? window_size : start + window_size - previous_end;
+            previous_end = start + window_size;
+            starts[next].push_back(start);
+
+            if (++next_window[next] < outputs[next].window_count) {
+                next_start[next] = outputs[next].window_start(next_window[next]);
+                if (next_start[next] < start) {
+                    throw stream_exception("Window starts must not decrease");
+                }
+            }
+        }
+    }
+
+    // The windows of all configs are read by start
+    vector<size_t> merged(starts.size(), 0);
+    order.clear();
+
+    while (true) {
+        size_t next = starts.size();
+        for (size_t c = 0; c < starts.size(); c++) {
+            if (merged[c] < starts[c].size() &&
+                (next == starts.size() || starts[c][merged[c]] < starts[next][merged[next]])) {
+                next = c;
+            }
+        }
+
+        if (next == starts.size()) {
+            break;
+        }
+
+        order.emplace_back(next, merged[next]++);
+    }
+
+    size_t later = get_next_config(outputs);
+    next_block_start = later == outputs.size() ? SIZE_MAX : next_start[later];
+
+    return !order.empty();
+}
+
+// The config with the first unread window that starts soonest, or
+// outputs.size() if all are read
+size_t stream_analyzer::get_next_config(const vector<output_t>& outputs) const
+{
+    size_t next = outputs.size();
+    for (size_t c = 0; c < outputs.size(); c++) {
+        if (next_window[c] < outputs[c].window_count &&
+            (next == outputs.size() || next_start[c] < next_start[next])) {
+            next = c;
+        }
+    }
+
+    return next;
+}
+
+// Reads the samples of the planned windows into `buffer`, keeping those
+// still needed from the previous block, and turns `starts` into offsets
+// into it
+void stream_analyzer::fill_block(wav_file& file)
+{
+    // The file has always been read up to sample offset + buffer.size()
+    size_t dropped = min(get_start(0) - offset, buffer.size());
+    buffer.erase(buffer.begin(), buffer.begin() + dropped);
+    offset += dropped;
+
+    // Reads go on through the windows after the current one for as long as
+    // they overlap, so the gaps between windows are never decoded, unless a
+    // later block needs them. Window `ahead` is the first one past the last
+    // read.
+    size_t ahead = 0;
+
+    for (size_t w = 0; w < order.size(); w++) {
+        size_t start = get_start(w),
+               end = get_end(w),
+               head = offset + buffer.size(),
+               remaining = file.get_total_samples() - file.get_samples_read();
+
+        if (min(start, next_block_start) > head) {
+            size_t skipped = min(min(start, next_block_start) - head, remaining);
+            file.skip_samples(skipped);
+            offset += skipped;
+            remaining -= skipped;
+            head += skipped;
+        }
+
+        if (end > head && remaining > 0) {
+            size_t read_end = end;
+            for (ahead = max(ahead, w + 1); ahead < order.size(); ahead++) {
+                if (get_start(ahead) > read_end || get_end(ahead) > head + STREAM_READ_SAMPLES) {
+                    break;
+                }
+
+                read_end = max(read_end, get_end(ahead));
+            }
+
+            size_t size = buffer.size();
+            buffer.resize(size + min(read_end - head, remaining));
+            file.read_samples(buffer.data() + size, buffer.size() - size);
+        }
+
+        starts[order[w].first][order[w].second] = start - offset;
+    }
+}
+
+template<typename Queue, typename T>
+bool stream_analyzer::push(Queue& queue, const T& item, stage_counters_t& counters)
+{
+    if (queue.try_push(item)) {
+        return true;
+    }
+
+    auto start = chrono::steady_clock::now();
+    queue_backoff backoff;
+
+    while (!queue.try_push(item)) {
+        if (failed) {
+            return false;
+        }
+
+        backoff.wait();
+    }
+
+    counters.waiting_seconds += seconds_since(start);
+    return true;
+}
+
+template<typename Queue, typename T>
+bool stream_analyzer::pop(Queue& queue, T& item, stage_counters_t& counters)
+{
+    if (queue.try_pop(item)) {
+        return true;
+    }
+
+    auto start = chrono::steady_clock::now();
+    queue_backoff backoff;
+
+    while (!queue.try_pop(item)) {
+        if (failed) {
+            return false;
+        }
+
+        backoff.wait();
+    }
+
+    counters.waiting_seconds += seconds_since(start);
+    return true;
+}
+
+void stream_analyzer::fail()
+{
+    lock_guard<mutex> guard(error_lock);
+    if (!error) {
+        error = current_exception();
+    }
+
+    failed = true;
+}
+
+void stream_analyzer::read_blocks(wav_file& file, const vector<output_t>& outputs)
+{
+    while (true) {
+        block_t* block;
+        if (!pop(free_blocks, block, read_counters)) {
+            return;
+        }
+
+        auto start = chrono::steady_clock::now();
+
+        if (!plan_block(outputs)) {
+            break;
+        }
+
+        fill_block(file);
+
+        block->samples.assign(buffer.begin(), buffer.end());
+        block->parts.resize(resolutions.size());
+
+        size_t task_count = 0;
+        for (size_t c = 0; c < resolutions.size(); c++) {
+            block_part_t& part = block->parts[c];
+            part.first = next_window[c] - starts[c].size();
+            part.starts.assign(starts[c].begin(), starts[c].end());
+            part.buckets.resize(starts[c].size() * resolutions[c].bucket_count);
+
+            task_count += (starts[c].size() + STREAM_TASK_WINDOWS - 1) / STREAM_TASK_WINDOWS;
+        }
+
+        block->tasks_left = task_count;
+
+        read_counters.windows += order.size();
+        read_counters.busy_seconds += seconds_since(start);
+
+        if (!push(ready_blocks, block, read_counters)) {
+            return;
+        }
+
+        for (size_t c = 0; c < resolutions.size(); c++) {
+            for (size_t t = 0; t * STREAM_TASK_WINDOWS < block->parts[c].starts.size(); t++) {
+                if (!push(tasks, task_t{block, c, t}, read_counters)) {
+                    return;
+                }
+            }
+        }
+    }
+
+    for (size_t worker = 0; worker < thread_count; worker++) {
+        if (!push(tasks, task_t{nullptr, 0, 0}, read_counters)) {
+            return;
+        }
+    }
+
+    push(ready_blocks, static_cast<block_t*>(nullptr), read_counters);
+}
+
+void stream_analyzer::analyze_tasks(size_t worker)
+{
+    stage_counters_t& counters = analyze_counters[worker];
+    task_t task;
+
+    while (pop(tasks, task, counters) && task.block) {
+        auto start = chrono::steady_clock::now();
+
+        const resolution_t& resolution = resolutions[task.resolution];
+        block_part_t& part = task.block->parts[task.resolution];
+        size_t first = task.index * STREAM_TASK_WINDOWS,
+               count = min(STREAM_TASK_WINDOWS, part.starts.size() - first);
+
+        resolution.engines[worker]->analyze(task.block->samples, &part.starts[first], count,
+                                            part.buckets.data() + first * resolution.bucket_count);
+
+        counters.windows += count;
+        counters.busy_seconds += seconds_since(start);
+
+        task.block->tasks_left.fetch_sub(1, memory_order_acq_rel);
+    }
+}
+
+void stream_analyzer::write_blocks(const vector<output_t>& outputs)
+{
+    block_t* block;
+    while (pop(ready_blocks, block, write_counters) && block) {
+        // Blocks are written in the order they were read, whichever
+        // finishes first
+        if (block->tasks_left.load(memory_order_acquire) != 0) {
+            auto start = chrono::steady_clock::now();
+            queue_backoff backoff;
+
+            while (block->tasks_left.load(memory_order_acquire) != 0) {
+                if (failed) {
+                    return;
+                }
+
+                backoff.wait();
+            }
+
+            write_counters.waiting_seconds += seconds_since(start);
+        }
+
+        auto start = chrono::steady_clock::now();
+
+        for (size_t c = 0; c < outputs.size(); c++) {
+            const block_part_t& part = block->parts[c];
+            size_t bucket_count = resolutions[c].bucket_count;
+
+            if (!part.starts.empty()) {
+                outputs[c].sink->write_block(part.first, part.starts.size(), bucket_count, part.buckets.data());
+            }
+
+            write_counters.windows += part.starts.size();
+        }
+
+        write_counters.busy_seconds += seconds_since(start);
+
+        if (!push(free_blocks, block, write_counters)) {
+            return;
+        }
+    }
+}
+
+void stream_analyzer::run(wav_file& file, const vector<output_t>& outputs)
+{
+    if (outputs.size() != resolutions.size()) {
+        throw stream_exception("Expected one output per analysis config");
+    }
+
+    if (file.get_samples_read() != 0) {
+        throw stream_exception("The file has already been read from");
+    }
+
+    buffer.clear();
+    offset = 0;
+    starts.assign(outputs.size(), vector<size_t>());
+    next_window.assign(outputs.size(), 0);
+    next_start.assign(outputs.size(), 0);
+
+    for (size_t c = 0; c < outputs.size(); c++) {
+        if (outputs[c].window_count > 0) {
+            next_start[c] = outputs[c].window_start(0);
+        }
+    }
+
+    failed = false;
+    error = nullptr;
+    read_counters = stage_counters_t();
+    write_counters = stage_counters_t();
+    fill(analyze_counters.begin(), analyze_counters.end(), stage_counters_t());
+
+    // A failed run can leave items behind
+    block_t* stale_block;
+    task_t stale_task;
+    while (free_blocks.try_pop(stale_block) || ready_blocks.try_pop(stale_block) || tasks.try_pop(stale_task)) {
+    }
+
+    for (auto& block : blocks) {
+        free_blocks.try_push(block.get());
+    }
+
+    for (size_t c = 0; c < outputs.size(); c++) {
+        outputs[c].sink->begin(outputs[c].window_count, resolutions[c].bucket_count);
+    }
+
+    thread reader([&]() {
+        try {
+            read_blocks(file, outputs);
+        } catch (...) {
+            fail();
+        }
+    });
+
+    vector<thread> workers;
+    for (size_t worker = 0; worker < thread_count; worker++) {
+        workers.emplace_back([this, worker]() {
+            try {
+                analyze_tasks(worker);
+            } catch (...) {
+                fail();
+            }
+        });
+    }
+
+    try {
+        write_blocks(outputs);
+    } catch (...) {
+        fail();
+    }
+
+    reader.join();
+    for (thread& t : workers) {
+        t.join();
+    }
+
+    if (error) {
+        rethrow_exception(error);
+    }
+
+    for (size_t c = 0; c < outputs.size(); c++) {
+        outputs[c].sink->end();
+    }
+}
+
+void stream_analyzer::run(wav_file& file,
+                          size_t window_count,
+                          const window_start_t& window_start,
+                          spectrum_sink& sink)
+{
+    run(file, vector<output_t>{{window_count, window_start, &sink}});
+}
+
+vector<stage_stats_t> stream_analyzer::get_stage_stats() const
+{
+    stage_stats_t analyze = {"analyze", thread_count, 0, 0.0, 0.0};
+    for (const stage_counters_t& counters : analyze_counters) {
+        analyze.windows += counters.windows;
+        analyze.busy_seconds += counters.busy_seconds;
+        analyze.waiting_seconds += counters.waiting_seconds;
+    }
+
+    return {
+        {"read", 1, read_counters.windows, read_counters.busy_seconds, read_counters.waiting_seconds},
+        analyze,
+        {"write", 1, write_counters.windows, write_counters.busy_seconds, write_counters.waiting_seconds}
+    };
+}
@@ -0,0 +1,248 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <memory>
+#include <iostream>
+#include <functional>
+#include <exception>
+#include <atomic>
+#include <mutex>
+#include "wav.hpp"
+#include "fft.hpp"
+#include "analysis.hpp"
+#include "spectrogram_matrix.hpp"
+#include "queue.hpp"
+
+namespace wavalyzer {
+    class stream_exception : public std::exception {
+    private:
+        std::string message;
+
+    public:
+        stream_exception(const std::string& _message)
+            : message(_message) {}
+
+        stream_exception(const std::string&& _message)
+            : message(std::move(_message)) {}
+
+        virtual const char* what() const throw() {
+            return message.c_str();
+        }
+    };
+
+    // Receives the buckets of every window as soon as they are analyzed,
+    // in window order, on the thread that called stream_analyzer::run
+    class spectrum_sink {
+    public:
+        virtual ~spectrum_sink() {}
+
+        virtual void begin(size_t window_count, size_t bucket_count) {}
+        virtual void write(size_t index, const float* buckets) = 0;
+
+        // Windows `first` to first + count at once, their buckets one
+        // window after another. Writes them one by one unless overridden.
+        virtual void write_block(size_t first, size_t count, size_t bucket_count, const float* buckets);
+        virtual void end() {}
+    };
+
+    // Writes the spectra straight into their columns of a matrix sized for
+    // all windows up front
+    class matrix_sink : public spectrum_sink {
+    private:
+        spectrogram_matrix& destination;
+
+    public:
+        matrix_sink(spectrogram_matrix& _destination);
+
+        void begin(size_t window_count, size_t bucket_count);
+        void write(size_t index, const float* buckets);
+        void write_block(size_t first, size_t count, size_t bucket_count, const float* buckets);
+    };
+
+    // Writes one tab separated line per window: its time in ms, then its
+    // buckets. The first line names the columns, with bucket frequencies
+    // in Hz.
+    class file_sink : public spectrum_sink {
+    private:
+        std::ostream& file;
+        size_t first_ms, step_ms, min_hertz, step_hertz, bucket_count;
+
+    public:
+        // Window i is centered at first_ms + i * step_ms
+        file_sink(std::ostream& _file,
+                  size_t _first_ms,
+                  size_t _step_ms,
+                  size_t _min_hertz,
+                  size_t _step_hertz);
+
+        void begin(size_t window_count, size_t bucket_count);
+        void write(size_t index, const float* buckets);
+        void end();
+    };
+
+    class callback_sink : public spectrum_sink {
+    public:
+        typedef std::function<void(size_t index, const float* buckets, size_t bucket_count)> callback_t;
+
+    private:
+        callback_t callback;
+        size_t bucket_count;
+
+    public:
+        callback_sink(const callback_t& _callback);
+
+        void begin(size_t window_count, size_t bucket_count);
+        void write(size_t index, const float* buckets);
+    };
+
+    // Work done and time spent by one stage of a stream_analyzer, summed
+    // over its threads. Waiting is time spent on a full queue downstream
+    // or an empty one upstream.
+    struct stage_stats_t {
+        std::string name;
+        size_t threads, windows;
+        double busy_seconds, waiting_seconds;
+    };
+
+    // Analyzes a wav_file front to back while reading it, in a pipeline of
+    // three stages connected by bounded queues:
+    //  - a reader thread decodes the samples of the next block of windows,
+    //  - a pool of workers analyzes its tasks (window, transform, buckets),
+    //  - the calling thread hands finished blocks to the sinks, in order.
+    // Only a few blocks are in flight at once, so a slow stage holds up the
+    // ones before it and memory use depends on the window sizes, step and
+    // thread count, not on the length of the file. Samples between windows
+    // that do not overlap are skipped without being decoded.
+    //
+    // Several analysis configs, such as different window sizes, can be
+    // analyzed in one pass. Blocks take tasks of every config over about the
+    // same stretch of the file, whose windows are read by start, so they
+    // share the reader, its buffer and the workers.
+    class stream_analyzer {
+    public:
+        typedef std::function<size_t(size_t index)> window_start_t;
+
+        // The windows to analyze for one config, and where their spectra go
+        struct output_t {
+            size_t window_count;
+            window_start_t window_start;
+            spectrum_sink* sink;
+        };
+
+    private:
+        struct resolution_t {
+            size_t window_size, bucket_count;
+
+            // One engine per worker
+            std::vector<std::unique_ptr<analysis_engine>> engines;
+        };
+
+        // The windows [first, first + starts.size()) of one config
+        struct block_part_t {
+            size_t first;
+            std::vector<size_t> starts;
+            std::vector<float> buckets;
+        };
+
+        struct block_t {
+            std::vector<float> samples;
+            std::vector<block_part_t> parts;
+            std::atomic<size_t> tasks_left;
+        };
+
+        struct task_t {
+            block_t* block;
+            size_t resolution, index;
+        };
+
+        struct stage_counters_t {
+            size_t windows;
+            double busy_seconds, waiting_seconds;
+        };
+
+        size_t thread_count;
+        std::vector<resolution_t> resolutions;
+
+        // Blocks cycle from the reader, through the workers, to the calling
+        // thread and back. A task with no block stops a worker, and no
+        // block stops the calling thread.
+        std::vector<std::unique_ptr<block_t>> blocks;
+        spsc_queue<block_t*> free_blocks, ready_blocks;
+        mpmc_queue<task_t> tasks;
+
+        // Set when any stage throws, which stops all of them
+        std::atomic<bool> failed;
+        std::mutex error_lock;
+        std::exception_ptr error;
+
+        stage_counters_t read_counters, write_counters;
+        std::vector<stage_counters_t> analyze_counters;
+
+        // Samples of the block being read. buffer[i] is sample i + offset of
+        // the file, from the last gap that was skipped on.
+        std::vector<float> buffer;
+        size_t offset;
+
+        // Per config: the first window not read yet and where it starts,
+        // and where the windows of the block being read start, in the file
+        // and then in `buffer`
+        std::vector<size_t> next_window, next_start;
+        std::vector<std::vector<size_t>> starts;
+
+        // Where the first window after the block being read starts. The
+        // samples from there on are not skipped.
+        size_t next_block_start;
+
+        // The windows of the block being read by start, as (config, index
+        // in the block)
+        std::vector<std::pair<size_t, size_t>> order;
+
+        size_t get_start(size_t window) const {
+            return starts[order[window].first][order[window].second];
+        }
+
+        size_t get_end(size_t window) const {
+            return get_start(window) + resolutions[order[window].first].window_size;
+        }
+
+        size_t get_next_config(const std::vector<output_t>& outputs) const;
+        bool plan_block(const std::vector<output_t>& outputs);
+        void fill_block(wav_file& file);
+
+        void read_blocks(wav_file& file, const std::vector<output_t>& outputs);
+        void analyze_tasks(size_t worker);
+        void write_blocks(const std::vector<output_t>& outputs);
+
+        template<typename Queue, typename T>
+        bool push(Queue& queue, const T& item, stage_counters_t& counters);
+
+        template<typename Queue, typename T>
+        bool pop(Queue& queue, T& item, stage_counters_t& counters);
+
+        void fail();
+
+    public:
+        // Throws analysis_exception for an unknown engine name
+        stream_analyzer(const std::string& engine, const std::vector<analysis_config_t>& configs, size_t threads);
+        stream_analyzer(const std::string& engine, const analysis_config_t& config, size_t threads);
+
+        size_t get_bucket_count(size_t config = 0) const {
+            return resolutions[config].bucket_count;
+        }
+
+        // Analyzes outputs[c].window_count windows for every config c, the
+        // i-th one starting at sample outputs[c].window_start(i), which must
+        // not decrease. The file must not have been read from yet. Samples
+        // past its end read as silence.
+        void run(wav_file& file, const std::vector<output_t>& outputs);
+
+        void run(wav_file& file,
+                 size_t window_count,
+                 const window_start_t& window_start,
+                 spectrum_sink& sink);
+
+        // Counters of the reading, analyzing and writing stages in the last
+        // run
+        std::vector<stage_stats_t> get_stage_stats() const;
+    };
+}
@@ -1,7 +1,13 @@
 #include "wav.hpp"
+#include "fft_kernels.hpp"
 #include <arpa/inet.h>
 #include <cassert>
 #include <cstring>
+#include <fstream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 
 using namespace wavalyzer;
 using namespace std;
@@ -12,9 +18,21 @@ namespace wavalyzer {
     const uint32_t DATA_MAGIC = 0x61746164;
     const uint32_t WAVE_MAGIC = 0x45564157;
     const size_t   FMT_CHUNK_SIZE = 16;
+    const size_t   FMT_EXTENSIBLE_CHUNK_SIZE = 40;
 
     enum audio_format_t {
-        FORMAT_LPCM = 1
+        FORMAT_LPCM = 1,
+        FORMAT_IEEE_FLOAT = 3,
+
+        // The actual format is the subformat of the extension
+        FORMAT_EXTENSIBLE = 0xfffe
+    };
+
+    struct sample_format_info_t {
+        const char* name;
+        sample_format_t format;
+        uint16_t audio_format;
+        size_t bits_per_sample;
     };
 
     struct __attribute__((packed)) riff_hdr_t {
@@ -37,9 +55,20 @@ namespace wavalyzer {
         uint16_t            bits_per_sample;
     };
 
+    // What follows fmt_chunk_t with FORMAT_EXTENSIBLE. The subformat is a
+    // GUID whose first two bytes are the audio format it stands for.
+    struct __attribute__((packed)) fmt_extension_t {
+        uint16_t            extension_size;
+        uint16_t            valid_bits_per_sample;
+        uint32_t            channel_mask;
+        uint16_t            sub_format;
+        uint8_t             sub_format_guid[14];
+    };
+
     struct wav_info_t {
         riff_hdr_t          riff_hdr;
         fmt_chunk_t         fmt_chunk;
+        fmt_extension_t     fmt_extension;
         chunk_hdr_t         data_chunk_hdr;
     };
 
@@ -69,14 +98,27 @@ namespace wavalyzer {
         }
     }
 
+    // The audio format the samples are actually in, looking through
+    // FORMAT_EXTENSIBLE
+    uint16_t wav_file_get_audio_format(const wav_info_t& hdr)
+    {
+        uint16_t audio_format = convert_endianness(hdr.fmt_chunk.audio_format);
+        if (audio_format == FORMAT_EXTENSIBLE) {
+            return convert_endianness(hdr.fmt_extension.sub_format);
+        }
+
+        return audio_format;
+    }
+
     void wav_file_check_sanity(const wav_info_t& hdr)
     {
         // Check if we're dealing with some weird compression
         const fmt_chunk_t& fmt = hdr.fmt_chunk;
-        switch (convert_endianness(fmt.audio_format)) {
+        switch (wav_file_get_audio_format(hdr)) {
             case FORMAT_LPCM: break;
+            case FORMAT_IEEE_FLOAT: break;
             default:
-                throw wav_file_parse_exception("Unsupported audio format (only LPCM is supported)");
+                throw wav_file_parse_exception("Unsupported audio format (only LPCM and IEEE float are supported)");
         }
 
         if (convert_endianness(fmt.sample_rate) == 0) {
@@ -92,15 +134,35 @@ namespace wavalyzer {
             throw wav_file_parse_exception("Bits per sample is 0");
         }
 
-        if (bits_per_sample != 8 && bits_per_sample != 16) {
-            throw wav_file_parse_exception("Unsupported sample bit depth");
+    }
+
+    const sample_format_info_t SAMPLE_FORMATS[] = {
+        { "8-bit unsigned PCM", SAMPLE_U8, FORMAT_LPCM, 8 },
+        { "16-bit PCM", SAMPLE_S16, FORMAT_LPCM, 16 },
+        { "24-bit PCM", SAMPLE_S24, FORMAT_LPCM, 24 },
+        { "32-bit PCM", SAMPLE_S32, FORMAT_LPCM, 32 },
+        { "32-bit float", SAMPLE_F32, FORMAT_IEEE_FLOAT, 32 },
+        { "64-bit float", SAMPLE_F64, FORMAT_IEEE_FLOAT, 64 }
+    };
+
+    const sample_format_info_t& wav_file_get_sample_format(const wav_info_t& hdr)
+    {
+        uint16_t audio_format = wav_file_get_audio_format(hdr);
+        size_t bits_per_sample = convert_endianness(hdr.fmt_chunk.bits_per_sample);
+
+        for (const sample_format_info_t& info : SAMPLE_FORMATS) {
+            if (info.audio_format == audio_format && info.bits_per_sample == bits_per_sample) {
+                return info;
+            }
         }
+
+        throw wav_file_parse_exception("Unsupported sample bit depth");
     }
 
     void wav_file_read_chunks(wav_info_t& destination, istream& file)
     {
         bool found_fmt = false, found_data = false;
-        char buffer[sizeof(fmt_chunk_t)];
+        char buffer[FMT_EXTENSIBLE_CHUNK_SIZE];
 
         while (!file.eof() && (!found_fmt || !found_data)) {
             union {
@@ -116,11 +178,23 @@ namespace wavalyzer {
                 }
 
                 found_fmt = true;
-                file.read(buffer, sizeof(fmt_chunk_t));
-                file.ignore(convert_endianness(h.hdr.chunk_size) - FMT_CHUNK_SIZE);
-
+                file.read(buffer, FMT_CHUNK_SIZE);
                 memcpy(reinterpret_cast<char*>(&destination.fmt_chunk), buffer, sizeof(fmt_chunk_t));
 
+                if (convert_endianness(destination.fmt_chunk.audio_format) == FORMAT_EXTENSIBLE) {
+                    if (convert_endianness(h.hdr.chunk_size) < FMT_EXTENSIBLE_CHUNK_SIZE) {
+                        throw wav_file_parse_exception("Unexpected length for extensible FMT chunk (should be at least 40)");
+                    }
+
+                    file.read(buffer + FMT_CHUNK_SIZE, FMT_EXTENSIBLE_CHUNK_SIZE - FMT_CHUNK_SIZE);
+                    file.ignore(convert_endianness(h.hdr.chunk_size) - FMT_EXTENSIBLE_CHUNK_SIZE);
+
+                    memcpy(reinterpret_cast<char*>(&destination.fmt_extension), buffer + FMT_CHUNK_SIZE,
+                           sizeof(fmt_extension_t));
+                } else {
+                    file.ignore(convert_endianness(h.hdr.chunk_size) - FMT_CHUNK_SIZE);
+                }
+
                 break;
 
             case DATA_MAGIC:
@@ -149,7 +223,49 @@ namespace wavalyzer {
 
 }
 
-wav_file::wav_file(std::istream& _file) : file(_file)
+string wavalyzer::get_sample_format_name(sample_format_t format)
+{
+    for (const sample_format_info_t& info : SAMPLE_FORMATS) {
+        if (info.format == format) {
+            return info.name;
+        }
+    }
+
+    return "unknown";
+}
+
+wav_file::wav_file(std::istream& _file)
+    : file(_file),
+      mapping(nullptr),
+      mapping_size(0),
+      data(nullptr)
+{
+    parse_header();
+}
+
+wav_file::wav_file(const string& filename)
+    : own_file(new ifstream(filename, ios::binary)),
+      file(*own_file),
+      mapping(nullptr),
+      mapping_size(0),
+      data(nullptr)
+{
+    if (!file) {
+        throw wav_file_parse_exception("Cannot open the file");
+    }
+
+    parse_header();
+    map_file(filename);
+}
+
+wav_file::~wav_file()
+{
+    if (mapping != nullptr) {
+        munmap(mapping, mapping_size);
+    }
+}
+
+void wav_file::parse_header()
 {
     union {
         riff_hdr_t hdr;
@@ -166,8 +282,10 @@ wav_file::wav_file(std::istream& _file) : file(_file)
     wav_file_check_sanity(info);
 
     fmt_chunk_t& fmt = info.fmt_chunk;
+    const sample_format_info_t& format = wav_file_get_sample_format(info);
 
-    bytes_per_sample = convert_endianness(fmt.bits_per_sample) / 8;
+    sample_format = format.format;
+    bytes_per_sample = format.bits_per_sample / 8;
     channels = convert_endianness(fmt.num_channels);
 
     if (channels > 1) {
@@ -187,66 +305,160 @@ wav_file::wav_file(std::istream& _file) : file(_file)
 
     // At this point, the next data to be read will be raw sample data.
     samples_read = 0;
+    data_start = file.tellg();
 }
 
-template<>
-void wav_file::interpret_samples<8>(const vector<uint8_t>& bytes, vector<sample_t>& destination)
+void wav_file::map_file(const string& filename)
 {
-    for (uint8_t byte : bytes) {
-        destination.push_back(2.0f * (byte / 255.0f) - 1.0f);
+    size_t data_bytes = total_samples * bytes_per_sample;
+    if (data_start == streampos(-1) || data_bytes == 0) {
+        return;
+    }
+
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return;
+    }
+
+    // A file shorter than its header says is read as a stream, which gives
+    // silence for the missing samples
+    struct stat info;
+    size_t data_offset = static_cast<size_t>(data_start);
+
+    if (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode) ||
+        static_cast<size_t>(info.st_size) < data_offset + data_bytes) {
+
+        close(fd);
+        return;
+    }
+
+    void* base = mmap(nullptr, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (base == MAP_FAILED) {
+        return;
     }
+
+    mapping = base;
+    mapping_size = info.st_size;
+    data = static_cast<const uint8_t*>(base) + data_offset;
 }
 
-template<>
-void wav_file::interpret_samples<16>(const vector<uint8_t>& bytes, vector<sample_t>& destination)
+void wav_file::decode_samples(const uint8_t* source, size_t sample_count, sample_t* destination)
 {
-    for (size_t i = 0; i < bytes.size(); i += 2) {
-        union {
-            int16_t integer;
-            uint8_t bytes[2];
-        } u;
-
-        u.bytes[0] = bytes[i];
-        u.bytes[1] = bytes[i + 1];
-
-        int16_t sample = u.integer;
-        sample_t sample_f;
-
-        if (sample < 0) {
-            sample_f = static_cast<sample_t>(sample) / (1 << 15);
-        } else {
-            sample_f = static_cast<sample_t>(sample) / ((1 << 15) - 1);
-        }
+    const fft_kernels_t& kernels = get_fft_kernels();
+
+    switch (sample_format) {
+    case SAMPLE_U8:
+        kernels.decode_u8(source, sample_count, destination);
+        break;
+
+    case SAMPLE_S16:
+        kernels.decode_s16(source, sample_count, destination);
+        break;
+
+    case SAMPLE_S24:
+        kernels.decode_s24(source, sample_count, destination);
+        break;
+
+    case SAMPLE_S32:
+        kernels.decode_s32(source, sample_count, destination);
+        break;
+
+    case SAMPLE_F32:
+        // Already what sample_t is
+        memcpy(destination, source, sample_count * sizeof(sample_t));
+        break;
 
-        destination.push_back(sample_f);
+    case SAMPLE_F64:
+        kernels.decode_f64(source, sample_count, destination);
+        break;
     }
 }
 
 void wav_file::read_samples(std::vector<sample_t>& destination, size_t sample_count)
+{
+    destination.resize(sample_count);
+    read_samples(destination.data(), sample_count);
+}
+
+void wav_file::read_samples(sample_t* destination, size_t sample_count)
 {
     if (sample_count > (total_samples - samples_read)) {
         throw wav_file_parse_exception("The sample count requested is past the end of file");
     }
 
-    vector<uint8_t> bytes;
     size_t byte_count = sample_count * bytes_per_sample;
-    bytes.resize(byte_count);
-    try {
-        file.read(reinterpret_cast<char*>(&bytes[0]), byte_count);
+    const uint8_t* source;
+
+    if (mapping != nullptr) {
+        source = data + samples_read * bytes_per_sample;
+    } else {
+        bytes.resize(byte_count);
+        try {
+            file.read(reinterpret_cast<char*>(bytes.data()), byte_count);
+        } catch (exception& e) {
+            throw wav_file_parse_exception("Unexpected read error / EOF");
+        }
+
+        // Whatever is missing reads as silence
+        size_t got = static_cast<size_t>(file.gcount());
+        if (got < byte_count) {
+            memset(bytes.data() + got, 0, byte_count - got);
+        }
+
+        source = bytes.data();
+    }
+
+    samples_read += sample_count;
+    decode_samples(source, sample_count, destination);
+}
+
+
+void wav_file::skip_samples(size_t sample_count)
+{
+    if (sample_count > (total_samples - samples_read)) {
+        throw wav_file_parse_exception("The sample count requested is past the end of file");
+    }
+
+    if (mapping != nullptr) {
         samples_read += sample_count;
-    } catch (exception& e) {
+        return;
+    }
+
+    file.ignore(sample_count * bytes_per_sample);
+    if (!file) {
         throw wav_file_parse_exception("Unexpected read error / EOF");
     }
 
-    destination.clear();
-    destination.reserve(sample_count);
+    samples_read += sample_count;
+}
 
-    if (bytes_per_sample == 1) {
-        interpret_samples<8>(bytes, destination);
-    } else if (bytes_per_sample == 2) {
-        interpret_samples<16>(bytes, destination);
-    } else {
-        throw wav_file_parse_exception("Unsupported sample bit depth");
+void wav_file::seek_sample(size_t index)
+{
+    if (index > total_samples) {
+        throw wav_file_parse_exception("The sample requested is past the end of file");
+    }
+
+    if (mapping != nullptr) {
+        samples_read = index;
+        return;
+    }
+
+    if (data_start == streampos(-1)) {
+        throw wav_file_parse_exception("Cannot seek in the file");
     }
+
+    file.clear();
+    file.seekg(data_start + static_cast<streamoff>(index * bytes_per_sample));
+    if (!file) {
+        throw wav_file_parse_exception("Cannot seek in the file");
+    }
+
+    samples_read = index;
 }
 
+pcm_view_t wav_file::get_pcm() const
+{
+    return pcm_view_t{data, mapping != nullptr ? total_samples : 0, bytes_per_sample, sample_format};
+}
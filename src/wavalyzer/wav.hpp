@@ -2,7 +2,9 @@
 #include <iostream>
 #include <string>
 #include <cstdint>
+#include <cstring>
 #include <vector>
+#include <memory>
 #include <exception>
 
 namespace wavalyzer {
@@ -22,12 +24,59 @@ namespace wavalyzer {
         }
     };
 
+    // How the samples are stored, whether the header says so with a plain
+    // format tag or with WAVE_FORMAT_EXTENSIBLE
+    enum sample_format_t {
+        SAMPLE_U8,
+        SAMPLE_S16,
+
+        // Packed in three bytes
+        SAMPLE_S24,
+        SAMPLE_S32,
+
+        // IEEE floats
+        SAMPLE_F32,
+        SAMPLE_F64
+    };
+
+    std::string get_sample_format_name(sample_format_t format);
+
+    // The samples of a mapped file as they are stored, little-endian and
+    // not necessarily aligned
+    struct pcm_view_t {
+        const std::uint8_t* data;
+        size_t count, bytes_per_sample;
+        sample_format_t format;
+
+        // Sample i as stored, for T of bytes_per_sample bytes: uint8_t for
+        // 8-bit samples, int16_t for 16-bit ones and so on. 24-bit samples
+        // have no such type.
+        template<typename T>
+        T get(size_t i) const {
+            T sample;
+            std::memcpy(&sample, data + i * sizeof(T), sizeof(T));
+            return sample;
+        }
+    };
+
     class wav_file {
     public:
         typedef float sample_t;
 
+        // Reads the samples from the stream
         wav_file(std::istream& _file);
 
+        // Maps the file instead, so that reading, skipping and seeking cost
+        // no system calls and decode straight from the page cache, which
+        // other processes share. Falls back to reading it as a stream if it
+        // cannot be mapped, say because it is a pipe. Throws
+        // wav_file_parse_exception if it cannot be opened.
+        wav_file(const std::string& filename);
+        ~wav_file();
+
+        wav_file(const wav_file&) = delete;
+        wav_file& operator=(const wav_file&) = delete;
+
         size_t get_total_samples() const {
             return total_samples;
         }
@@ -44,13 +93,52 @@ namespace wavalyzer {
             return samples_read;
         }
 
+        sample_format_t get_sample_format() const {
+            return sample_format;
+        }
+
+        // Replaces the contents of `destination` with the next sample_count
+        // samples
         void read_samples(std::vector<sample_t>& destination, size_t sample_count);
 
+        // Decodes the next sample_count samples straight into `destination`,
+        // in bulk with the kernels of get_fft_kernels()
+        void read_samples(sample_t* destination, size_t sample_count);
+
+        // Moves past sample_count samples without decoding them
+        void skip_samples(size_t sample_count);
+
+        // Moves to sample `index`, back or forth. The stream must support
+        // seeking.
+        void seek_sample(size_t index);
+
+        bool is_mapped() const {
+            return mapping != nullptr;
+        }
+
+        // Every sample of a mapped file, undecoded; empty unless is_mapped()
+        pcm_view_t get_pcm() const;
+
     private:
         size_t total_samples, sample_rate, channels, bytes_per_sample, samples_read;
+        sample_format_t sample_format;
+
+        // Only set when the file was opened by name; declared before `file`,
+        // which refers to it
+        std::unique_ptr<std::istream> own_file;
         std::istream& file;
+        std::streampos data_start;
+
+        // The whole file while mapped, and its data chunk within it
+        void* mapping;
+        size_t mapping_size;
+        const std::uint8_t* data;
+
+        // Bytes read from the stream, kept for the next read
+        std::vector<std::uint8_t> bytes;
 
-        template<size_t BitDepth>
-        void interpret_samples(const std::vector<std::uint8_t>& bytes, std::vector<sample_t>& destination);
+        void parse_header();
+        void map_file(const std::string& filename);
+        void decode_samples(const std::uint8_t* source, size_t sample_count, sample_t* destination);
     };
 }
@@ -1,61 +1,179 @@
 #include "window.hpp"
 #include <cmath>
+#include <cstdlib>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <tuple>
 
 using namespace wavalyzer;
 using namespace std;
 
+const double PI = 3.14159265358979323846;
+
+// Kaiser's beta when none is given, which puts its side lobes about as low
+// as Blackman-Harris's
+const float DEFAULT_KAISER_BETA = 8.6f;
+
 namespace wavalyzer {
-    struct hamming_window {
-        float operator()(float alpha) const;
-    };
+    struct window_info_t {
+        const char* name;
+        window_type_t type;
 
-    struct hann_window {
-        float operator()(float alpha) const;
+        // Empty unless the window is a cosine sum
+        vector<float> cosine_terms;
     };
 
-    template<typename Window>
-    void apply_window(vector<float>& samples);
+    const window_info_t& get_window_info(window_type_t type);
+
+    // Modified Bessel function of the first kind, of order zero
+    double bessel_i0(double x);
+
+    void compute_window(const window_t& window, size_t size, window_table_t& table);
 }
 
-template<typename Window>
-void wavalyzer::apply_window(vector<float>& samples)
+// Every window there is. Adding one only takes an entry here, and a way to
+// compute it in compute_window if it is not a cosine sum.
+const window_info_t WINDOWS[] = {
+    { "hann", WINDOW_HANN, { 0.5f, 0.5f } },
+    { "hamming", WINDOW_HAMMING, { 0.54f, 0.46f } },
+    // The 4-term, -92 dB Blackman-Harris
+    { "blackman-harris", WINDOW_BLACKMAN_HARRIS, { 0.35875f, 0.48829f, 0.14128f, 0.01168f } },
+    // Flat to 0.01 dB over a bin, for reading levels off peaks
+    { "flat-top", WINDOW_FLAT_TOP, { 0.21557895f, 0.41663158f, 0.277263158f, 0.083578947f, 0.006947368f } },
+    { "kaiser", WINDOW_KAISER, {} }
+};
+
+const window_info_t& wavalyzer::get_window_info(window_type_t type)
 {
-    Window w;
-    for (size_t i = 0; i < samples.size(); i++) {
-        float alpha = static_cast<float>(i) / (samples.size() - 1);
-        samples[i] *= w(alpha);
+    for (const window_info_t& info : WINDOWS) {
+        if (info.type == type) {
+            return info;
+        }
     }
+
+    throw window_exception("Unknown window type");
 }
 
-const float HAMMING_ALPHA = 0.54f;
-const float HAMMING_BETA = 1.0f - HAMMING_ALPHA;
+double wavalyzer::bessel_i0(double x)
+{
+    // sum_k ((x / 2)^k / k!)^2, until the terms stop mattering
+    double sum = 1.0, term = 1.0;
+    for (int k = 1; term > sum * 1e-17; k++) {
+        double factor = x / (2 * k);
+        term *= factor * factor;
+        sum += term;
+    }
 
-float wavalyzer::hamming_window::operator()(float alpha) const
+    return sum;
+}
+
+void wavalyzer::compute_window(const window_t& window, size_t size, window_table_t& table)
 {
-    return HAMMING_ALPHA - HAMMING_BETA * cos(2 * M_PI * alpha);
+    const vector<float>& terms = get_window_info(window.type).cosine_terms;
+    table.coefficients.resize(size);
+
+    for (size_t i = 0; i < size; i++) {
+        // The symmetric form, from 0 to 1 over the whole window
+        double alpha = size > 1 ? static_cast<double>(i) / (size - 1) : 0.5,
+               w = 0.0;
+
+        if (window.type == WINDOW_KAISER) {
+            double x = 2 * alpha - 1;
+            w = bessel_i0(window.parameter * sqrt(max(0.0, 1 - x * x))) / bessel_i0(window.parameter);
+        } else {
+            for (size_t m = 0; m < terms.size(); m++) {
+                w += (m % 2 == 0 ? 1.0 : -1.0) * terms[m] * cos(2 * PI * m * alpha);
+            }
+        }
+
+        table.coefficients[i] = static_cast<float>(w);
+    }
+
+    double sum = 0.0, sum_squares = 0.0;
+    for (float w : table.coefficients) {
+        sum += w;
+        sum_squares += static_cast<double>(w) * w;
+    }
+
+    table.coherent_gain = static_cast<float>(sum / size);
+    table.enbw = static_cast<float>(size * sum_squares / (sum * sum));
 }
 
-float wavalyzer::hann_window::operator()(float alpha) const
+window_t wavalyzer::parse_window(const string& name)
 {
-    return pow(sin(M_PI * alpha), 2.0f);
+    size_t colon_index = name.find(':');
+    string type = name.substr(0, colon_index);
+
+    for (const window_info_t& info : WINDOWS) {
+        if (type != info.name) {
+            continue;
+        }
+
+        window_t window = { info.type, 0.0f };
+        if (info.type == WINDOW_KAISER) {
+            window.parameter = DEFAULT_KAISER_BETA;
+        }
+
+        if (colon_index != string::npos) {
+            string parameter = name.substr(colon_index + 1);
+            char* end;
+            window.parameter = strtof(parameter.c_str(), &end);
+
+            if (info.type != WINDOW_KAISER || parameter.empty() || *end != '\0' ||
+                !(window.parameter >= 0.0f)) {
+                throw window_exception("Invalid window parameter `" + parameter + "`");
+            }
+        }
+
+        return window;
+    }
+
+    throw window_exception("Unknown window type `" + type + "`");
 }
 
-void wavalyzer::apply_hamming_window(vector<float>& samples)
+string wavalyzer::get_window_name(const window_t& window)
 {
-    apply_window<hamming_window>(samples);
+    ostringstream name;
+    name << get_window_info(window.type).name;
+
+    if (window.type == WINDOW_KAISER) {
+        name << ":" << window.parameter;
+    }
+
+    return name.str();
 }
 
-void wavalyzer::apply_hann_window(vector<float>& samples)
+vector<string> wavalyzer::get_window_names()
 {
-    apply_window<hann_window>(samples);
+    vector<string> names;
+    for (const window_info_t& info : WINDOWS) {
+        names.push_back(info.name);
+    }
+
+    return names;
 }
 
-float wavalyzer::get_hamming_window_gain()
+const window_table_t& wavalyzer::get_window(const window_t& window, size_t size)
 {
-    return (HAMMING_ALPHA + HAMMING_BETA) / 2.0f;
+    // A table is never moved or freed once made, so references to it stay
+    // good outside the lock
+    static mutex lock;
+    static map<tuple<int, float, size_t>, unique_ptr<window_table_t>> tables;
+
+    lock_guard<mutex> guard(lock);
+    unique_ptr<window_table_t>& table = tables[make_tuple(static_cast<int>(window.type), window.parameter, size)];
+
+    if (!table) {
+        table.reset(new window_table_t());
+        compute_window(window, size, *table);
+    }
+
+    return *table;
 }
 
-float wavalyzer::get_hann_window_gain()
+vector<float> wavalyzer::get_window_cosine_terms(const window_t& window)
 {
-    return 0.5f;
+    return get_window_info(window.type).cosine_terms;
 }
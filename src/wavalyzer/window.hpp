@@ -1,10 +1,66 @@
 #pragma once
+#include <cstddef>
+#include <string>
 #include <vector>
+#include <exception>
 
 namespace wavalyzer {
-    void apply_hamming_window(std::vector<float>& samples);
-    void apply_hann_window(std::vector<float>& samples);
+    class window_exception : public std::exception {
+    private:
+        std::string message;
 
-    float get_hamming_window_gain();
-    float get_hann_window_gain();
+    public:
+        window_exception(const std::string& _message)
+            : message(_message) {}
+
+        window_exception(const std::string&& _message)
+            : message(std::move(_message)) {}
+
+        virtual const char* what() const throw() {
+            return message.c_str();
+        }
+    };
+
+    enum window_type_t {
+        WINDOW_HANN,
+        WINDOW_HAMMING,
+        WINDOW_BLACKMAN_HARRIS,
+        WINDOW_FLAT_TOP,
+        WINDOW_KAISER
+    };
+
+    struct window_t {
+        window_type_t type;
+
+        // Beta of a Kaiser window; zero for the others
+        float parameter;
+    };
+
+    // The coefficients of a window of some size, and its gains as measured
+    // on them
+    struct window_table_t {
+        std::vector<float> coefficients;
+
+        // The mean coefficient, which is what a sinusoid centered on a bin
+        // gets scaled by
+        float coherent_gain;
+
+        // Equivalent noise bandwidth in bins, N sum w^2 / (sum w)^2
+        float enbw;
+    };
+
+    // Parses a window name as given on the command line: one of
+    // get_window_names(), with Kaiser taking an optional `:beta`. Throws
+    // window_exception for anything else.
+    window_t parse_window(const std::string& name);
+    std::string get_window_name(const window_t& window);
+    std::vector<std::string> get_window_names();
+
+    // The window of `size` samples, computed on first use and shared from
+    // then on. The table lives as long as the program.
+    const window_table_t& get_window(const window_t& window, size_t size);
+
+    // The a_m of a window that is the cosine sum sum_m (-1)^m a_m
+    // cos(2 pi m n / N), or nothing if it is not one
+    std::vector<float> get_window_cosine_terms(const window_t& window);
 }